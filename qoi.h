@@ -65,9 +65,34 @@ void *rgba_pixels = qoi_read("image.qoi", &desc, 4);
 
 This library provides the following functions;
 - qoi_read    -- read and decode a QOI file
+- qoi_read_header, qoi_probe -- read only the header of a QOI file or image
+- qoi_read_direct -- read and decode a large QOI file, bypassing the page cache
 - qoi_decode  -- decode the raw bytes of a QOI image from memory
 - qoi_write   -- encode and write a QOI file
 - qoi_encode  -- encode an rgba buffer into a QOI image in memory
+- qoi_read64, qoi_decode64, qoi_write64, qoi_encode64 -- the same for images
+  with more than 400 million pixels
+- qoi_encode_into  -- encode an rgba buffer into caller supplied memory
+- qoi_encode_bound -- the buffer size qoi_encode_into needs at most
+- qoi_encode_ex   -- encode BGRA, ARGB, ... buffers with arbitrary row stride
+- qoi_encoder_*   -- encode an image row by row, through a write callback
+- qoi_encode_mt   -- encode an image using multiple threads
+- qoi_decode_ex   -- decode and optionally collect statistics
+- qoi_decode_into -- decode into caller supplied memory, with row stride
+- qoi_ctx_*       -- encode or decode many images, reusing the output buffer
+- qoi_decoder_*   -- decode an image row by row, from slices of the input
+- qoi_decode_rows -- decode an image row by row, reading input on demand
+- qoi_encode_seekable -- encode an image with a seek index for random access
+- qoi_decode_mt   -- decode an image with a seek index using multiple threads
+- qoi_decode_rows_at -- decode a range of rows
+- qoi_decode_region -- decode a rectangle of an image
+- qoi_decode_scaled -- decode an image reduced to 1/2, 1/4 or 1/8 of its size
+- qoi_encode_tiled, qoi_decode_tiled, qoi_decode_tile -- images stored as
+  independently encoded tiles, for random access and parallel en-/decoding
+- qoi_seq_encoder_*, qoi_seq_decoder_* -- sequences of frames that only
+  encode the pixels that changed since the previous frame
+- qoi_encode_io -- encode an image through a write callback
+- qoi_decode_io -- decode an image through a read callback
 
 See the function declaration below for the signature and more information.
 
@@ -75,11 +100,26 @@ If you don't want/need the qoi_read and qoi_write functions, you can define
 QOI_NO_STDIO before including this library.
 
 This library uses malloc() and free(). To supply your own malloc implementation
-you can define QOI_MALLOC and QOI_FREE before including this library.
+you can define QOI_MALLOC and QOI_FREE before including this library. The
+qoi_encode_ex and qoi_decode_ex functions and qoi_ctx also accept a
+qoi_allocator, to use a different allocator for each call; all other functions
+only use QOI_MALLOC and QOI_FREE, see qoi_allocator.
 
 This library uses memset() to zero-initialize the index. To supply your own
 implementation you can define QOI_ZEROARR before including this library.
 
+Define QOI_STATS before including this library to have qoi_encode_ex and
+qoi_decode_ex fill a qoi_stats struct with op counts and timings.
+
+By default all work is done on the calling thread. Define QOI_THREADS before
+including this library to let the functions that take nthreads (and
+qoi_read_direct) use multiple threads. They use pthreads, so on POSIX systems
+the program then needs to be linked with -pthread, or Win32 threads on Windows.
+
+On x86 this library uses SSE2 (and AVX2, if enabled in the compiler) to find
+runs of identical pixels in the encoder. To use the plain C code paths instead
+you can define QOI_NO_SIMD before including this library.
+
 
 -- Data Format
 
@@ -235,6 +275,8 @@ Header - Public functions */
 #ifndef QOI_H
 #define QOI_H
 
+#include <stddef.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -267,8 +309,12 @@ typedef struct {
 system. The qoi_desc struct must be filled with the image width, height,
 number of channels (3 = RGB, 4 = RGBA) and the colorspace.
 
-The function returns 0 on failure (invalid parameters, or fopen or malloc
-failed) or the number of bytes written on success. */
+The image is encoded through a buffer of QOI_ENCODER_BUFFER_SIZE bytes that
+is written to the file whenever it fills up, so memory use does not depend on
+the image size. If writing fails, the file may be left incomplete.
+
+The function returns 0 on failure (invalid parameters, or fopen, fwrite or
+malloc failed) or the number of bytes written on success. */
 
 int qoi_write(const char *filename, const void *data, const qoi_desc *desc);
 
@@ -281,10 +327,45 @@ The function either returns NULL on failure (invalid data, or malloc or fopen
 failed) or a pointer to the decoded pixels. On success, the qoi_desc struct
 will be filled with the description from the file header.
 
+On POSIX systems the file is mapped into memory with mmap() and decoded from
+the mapping, so it is never copied into a buffer; files that cannot be mapped
+are read normally. Define QOI_NO_MMAP to always read the file into a buffer.
+
 The returned pixel data should be free()d after use. */
 
 void *qoi_read(const char *filename, qoi_desc *desc, int channels);
 
+
+/* Variants of qoi_write and qoi_read for files of 2GB and more. These are not
+limited to QOI_PIXELS_MAX pixels and use size_t for all sizes; otherwise they
+behave like qoi_write and qoi_read. */
+
+size_t qoi_write64(const char *filename, const void *data, const qoi_desc *desc);
+void *qoi_read64(const char *filename, qoi_desc *desc, int channels);
+
+
+/* Read only the header of a QOI file, with a single read of 14 bytes, and fill
+the qoi_desc struct with its description. The header is checked like in
+qoi_read. Returns 1 on success or 0 on failure (fopen failed, the file is too
+short or the header is invalid). */
+
+int qoi_read_header(const char *filename, qoi_desc *desc);
+
+
+/* Read and decode a QOI image from the file system like qoi_read64, for very
+large files. The file is read in QOI_READ_AHEAD_BUFFERS buffers of
+QOI_READ_AHEAD_SIZE bytes that a helper thread fills while the image is being
+decoded, and bypasses the page cache: with O_DIRECT where the file system
+supports it (on Linux, define _GNU_SOURCE before including this library),
+F_NOCACHE on macOS, or by dropping the pages that have been read otherwise.
+Besides the pixels, only these buffers are allocated. NULL is returned if the
+file is truncated, or if reading it fails, with errno set.
+
+Without QOI_THREADS the file is read on the calling thread; on systems without
+POSIX this is the same as qoi_read64. */
+
+void *qoi_read_direct(const char *filename, qoi_desc *desc, int channels);
+
 #endif /* QOI_NO_STDIO */
 
 
@@ -299,6 +380,206 @@ The returned qoi data should be free()d after use. */
 void *qoi_encode(const void *data, const qoi_desc *desc, int *out_len);
 
 
+/* Return the maximum number of bytes qoi_encode_into() may need to encode an
+image with the given qoi_desc, or 0 if the qoi_desc is invalid. */
+
+size_t qoi_encode_bound(const qoi_desc *desc);
+
+
+/* Encode raw RGB or RGBA pixels into a QOI image in a caller supplied buffer of
+out_cap bytes. A buffer of qoi_encode_bound() bytes is always large enough;
+smaller buffers work as long as the encoded image fits.
+
+The function returns 0 on failure (invalid parameters or out_cap too small) or
+1 on success. On success out_len is set to the size in bytes of the encoded
+data. */
+
+int qoi_encode_into(
+	const void *data, const qoi_desc *desc,
+	void *out, size_t out_cap, size_t *out_len
+);
+
+
+/* Op statistics, collected by qoi_encode_ex and qoi_decode_ex when QOI_STATS
+is defined. Without QOI_STATS qoi_stats is an incomplete type and NULL must be
+passed for the stats parameter.
+
+chunks and bytes are indexed by the QOI_STAT_* constants. The header and the
+end marker are not counted. index_hit_rate is the fraction of chunks other than
+QOI_OP_RUN that are a QOI_OP_INDEX. runs is a histogram of run lengths, with
+consecutive QOI_OP_RUNs counted as one run: runs[i] counts the runs of 2^i to
+2^(i+1)-1 pixels; the last bucket also counts all longer runs. time_ns is the
+time spent en-/decoding, not including the allocation of the output or the
+collection of the statistics. It does include the page faults when the output
+is first written to. */
+
+#define QOI_STAT_INDEX 0
+#define QOI_STAT_DIFF  1
+#define QOI_STAT_LUMA  2
+#define QOI_STAT_RUN   3
+#define QOI_STAT_RGB   4
+#define QOI_STAT_RGBA  5
+#define QOI_STAT_OPS   6
+
+#define QOI_STATS_RUN_BUCKETS 16
+
+/* A custom allocator for the qoi_encode_ex and qoi_decode_ex functions. alloc
+must return a pointer to size bytes of memory, or NULL on failure; free must
+release memory returned by alloc, and is never passed NULL. user is passed to
+both. A NULL qoi_allocator means QOI_MALLOC and QOI_FREE.
+
+Only qoi_encode_ex, qoi_decode_ex and the qoi_ctx functions use a
+qoi_allocator. All other functions allocate their results and internal buffers
+with QOI_MALLOC and QOI_FREE, namely
+	qoi_encode, qoi_encode64, qoi_encode_mt, qoi_encode_seekable,
+	qoi_encode_tiled, qoi_encode_io, qoi_encoder_init,
+	qoi_seq_encoder_init, qoi_seq_encoder_push,
+	qoi_decode, qoi_decode64, qoi_decode_mt, qoi_decode_rows_at,
+	qoi_decode_region, qoi_decode_scaled, qoi_decode_tiled, qoi_decode_tile,
+	qoi_decode_io, qoi_decoder_push, qoi_decoder_open, qoi_seq_decoder_open,
+	qoi_read, qoi_read64, qoi_read_direct, qoi_write, qoi_write64
+To route these to a per-request arena, define QOI_MALLOC and QOI_FREE to
+functions that look up the arena of the calling thread. All allocations happen
+on the calling thread; the helper threads of the multi-threaded functions
+allocate nothing. */
+
+typedef struct {
+	void *(*alloc)(void *user, size_t size);
+	void (*free)(void *user, void *ptr);
+	void *user;
+} qoi_allocator;
+
+
+#ifdef QOI_STATS
+typedef struct qoi_stats {
+	size_t chunks[QOI_STAT_OPS];
+	size_t bytes[QOI_STAT_OPS];
+	size_t pixels;
+	double index_hit_rate;
+	size_t runs[QOI_STATS_RUN_BUCKETS];
+	unsigned long long time_ns;
+} qoi_stats;
+#else
+typedef struct qoi_stats qoi_stats;
+#endif
+
+
+/* Encode pixels in any of the following source layouts into a QOI image in
+memory:
+	QOI_LAYOUT_RGBA, QOI_LAYOUT_BGRA, QOI_LAYOUT_ARGB -- 4 bytes per pixel
+	QOI_LAYOUT_RGBX -- 4 bytes per pixel, the 4th byte is ignored
+	QOI_LAYOUT_RGB, QOI_LAYOUT_BGR -- 3 bytes per pixel
+
+desc->channels is the number of channels stored in the QOI image. If it's 3,
+the alpha channel of the source is ignored. stride is the distance in bytes
+between the start of two rows; 0 means the rows are tightly packed. The
+channels are swizzled while encoding, so no temporary copy is made. If stats is
+not NULL, it is filled with the op statistics of the encoded image. The output
+is allocated with allocator, see qoi_allocator.
+
+The function either returns NULL on failure (invalid parameters or malloc
+failed) or a pointer to the encoded data on success. On success the out_len
+is set to the size in bytes of the encoded data.
+
+The returned qoi data should be released with allocator->free, or free()d if
+allocator is NULL. */
+
+#define QOI_LAYOUT_RGBA 0
+#define QOI_LAYOUT_RGB  1
+#define QOI_LAYOUT_BGRA 2
+#define QOI_LAYOUT_BGR  3
+#define QOI_LAYOUT_ARGB 4
+#define QOI_LAYOUT_RGBX 5
+
+void *qoi_encode_ex(
+	const void *data, const qoi_desc *desc, size_t stride, int layout,
+	size_t *out_len, qoi_stats *stats, const qoi_allocator *allocator
+);
+
+
+/* Encode raw RGB or RGBA pixels into a QOI image in memory, using up to
+nthreads threads. The output is identical to that of qoi_encode. Images that
+are too small to benefit from threads are encoded on the calling thread.
+
+Threads are only used if QOI_THREADS is defined, see above; otherwise all work
+is done on the calling thread.
+
+The function either returns NULL on failure (invalid parameters or malloc
+failed) or a pointer to the encoded data on success. On success the out_len
+is set to the size in bytes of the encoded data.
+
+The returned qoi data should be free()d after use. */
+
+void *qoi_encode_mt(
+	const void *data, const qoi_desc *desc, int nthreads, size_t *out_len
+);
+
+
+/* Incremental encoder. Instead of handing the whole image to qoi_encode, rows
+can be pushed as they become available:
+
+	qoi_encoder enc;
+	qoi_encoder_init(&enc, &desc, my_write, my_user);
+	while (...) {
+		qoi_encoder_push_rows(&enc, rows, nrows);
+	}
+	qoi_encoder_finish(&enc);
+
+The encoded bytes are collected in a QOI_ENCODER_BUFFER_SIZE buffer and handed
+to the write callback whenever it fills up. The write callback must return 1
+on success or 0 on failure. The output is identical to that of qoi_encode.
+
+qoi_encoder_init returns 0 on failure (invalid parameters or malloc failed).
+qoi_encoder_push_rows returns 0 if the write callback failed or more rows than
+desc->height were pushed. qoi_encoder_finish returns 0 if any call failed or
+fewer than desc->height rows were pushed, otherwise 1; enc->size then holds
+the total number of bytes written. qoi_encoder_finish must always be called
+after a successful qoi_encoder_init, to free the buffer. */
+
+typedef int (*qoi_write_fn)(void *user, const void *data, size_t len);
+
+typedef union {
+	struct { unsigned char r, g, b, a; } rgba;
+	unsigned int v;
+} qoi_rgba_t;
+
+typedef struct {
+	qoi_rgba_t index[64];
+	qoi_rgba_t px_prev;
+	int run;
+} qoi_enc_state;
+
+typedef struct {
+	qoi_desc desc;
+	qoi_enc_state state;
+	unsigned char *(*encode)(
+		qoi_enc_state *s, const unsigned char *pixels,
+		const unsigned char *pixels_end, unsigned char *bytes
+	);
+	qoi_write_fn write;
+	void *user;
+	unsigned char *buf;
+	size_t buf_len;
+	size_t size;
+	unsigned int rows;
+	int error;
+} qoi_encoder;
+
+int qoi_encoder_init(
+	qoi_encoder *enc, const qoi_desc *desc, qoi_write_fn write, void *user
+);
+int qoi_encoder_push_rows(qoi_encoder *enc, const void *rows, unsigned int nrows);
+int qoi_encoder_finish(qoi_encoder *enc);
+
+
+/* Check whether data starts with a valid QOI header, like qoi_decode does, and
+fill the qoi_desc struct with its description. Only the first 14 bytes (the
+size of the header) are needed. Returns 1 on success or 0 if data is too short
+or the header is invalid. */
+
+int qoi_probe(const void *data, size_t size, qoi_desc *desc);
+
+
 /* Decode a QOI image from memory.
 
 The function either returns NULL on failure (invalid parameters or malloc
@@ -310,6 +591,399 @@ The returned pixel data should be free()d after use. */
 void *qoi_decode(const void *data, int size, qoi_desc *desc, int channels);
 
 
+/* Variants of qoi_encode and qoi_decode for images with more than 400 million
+pixels (QOI_PIXELS_MAX), which the int based functions refuse. All sizes are
+size_t; otherwise these behave like qoi_encode and qoi_decode. All other
+functions that use size_t for sizes have no QOI_PIXELS_MAX limit either. */
+
+void *qoi_encode64(const void *data, const qoi_desc *desc, size_t *out_len);
+void *qoi_decode64(const void *data, size_t size, qoi_desc *desc, int channels);
+
+
+/* Decode a QOI image from memory like qoi_decode64. If stats is not NULL, it is
+filled with the op statistics of the image (see qoi_stats above). The pixels
+are allocated with allocator and should be released with allocator->free, or
+free()d if allocator is NULL (see qoi_allocator above). */
+
+void *qoi_decode_ex(
+	const void *data, size_t size, qoi_desc *desc, int channels,
+	qoi_stats *stats, const qoi_allocator *allocator
+);
+
+
+/* Decode a QOI image from memory into a caller supplied buffer. Row y of the
+image is written to out + y * out_stride; out_stride is the distance in bytes
+between the start of two rows, 0 means the rows are tightly packed. The buffer
+must be large enough for all rows of the image; the dimensions can be read from
+the header beforehand.
+
+flags is 0 or a combination of
+	QOI_FLIP_Y -- write the rows bottom-up, i.e. row y of the image to
+		out + (height - 1 - y) * out_stride, as expected by OpenGL
+	QOI_DISPATCH_TABLE -- use a decoder that dispatches on the op through a
+		lookup table instead of a chain of compares. The result is the same;
+		which one is faster depends on the CPU and the images. On x86-64
+		the compare chain has been faster so far, by far the most on
+		images with many QOI_OP_RGBA chunks.
+
+The function returns 0 on failure (invalid parameters or data, or out_stride
+too small) or 1 on success. On success, the qoi_desc struct is filled with the
+description from the file header. */
+
+#define QOI_FLIP_Y         1
+#define QOI_DISPATCH_TABLE 2
+
+int qoi_decode_into(
+	const void *data, size_t size, qoi_desc *desc, int channels,
+	void *out, size_t out_stride, int flags
+);
+
+
+/* Reusable contexts for encoding or decoding many images in a row. A qoi_ctx
+keeps its output buffer between calls and only grows it when an image needs
+more room, so once it has seen the largest image no more memory is allocated:
+
+	qoi_ctx ctx;
+	qoi_ctx_init(&ctx, NULL);
+	for (...) {
+		const void *encoded = qoi_ctx_encode(&ctx, pixels, &desc, &len);
+		...
+	}
+	qoi_ctx_free(&ctx);
+
+qoi_ctx_init takes a qoi_allocator for the buffer, or NULL for QOI_MALLOC and
+QOI_FREE; the allocator must remain valid until qoi_ctx_free.
+
+qoi_ctx_encode encodes like qoi_encode64 and qoi_ctx_decode decodes like
+qoi_decode64, but the returned data belongs to the context and is only valid
+until the next call with the same context; it must not be freed. Both return
+NULL on failure (invalid parameters or data, or malloc failed).
+
+qoi_ctx_trim releases the buffer if it is larger than keep bytes, e.g. after
+an unusually large image or under memory pressure; a keep of 0 always releases
+it. qoi_ctx_free releases the buffer. */
+
+typedef struct {
+	const qoi_allocator *allocator;
+	unsigned char *buf;
+	size_t cap;
+} qoi_ctx;
+
+void qoi_ctx_init(qoi_ctx *ctx, const qoi_allocator *allocator);
+const void *qoi_ctx_encode(
+	qoi_ctx *ctx, const void *data, const qoi_desc *desc, size_t *out_len
+);
+const void *qoi_ctx_decode(
+	qoi_ctx *ctx, const void *data, size_t size, qoi_desc *desc, int channels
+);
+void qoi_ctx_trim(qoi_ctx *ctx, size_t keep);
+void qoi_ctx_free(qoi_ctx *ctx);
+
+
+/* Push decoder. Instead of waiting for the whole image, the encoded bytes can
+be handed to the decoder in slices of any size as they arrive, e.g. from a
+socket or a pipe:
+
+	qoi_decoder dec;
+	qoi_decoder_init(&dec, channels, my_row, my_user);
+	while ((len = recv(sock, buf, sizeof(buf), 0)) > 0) {
+		if (!qoi_decoder_push(&dec, buf, len)) {
+			break;
+		}
+	}
+	qoi_decoder_finish(&dec);
+
+A slice may end anywhere, also in the middle of the header or of a chunk. Once
+the header is complete, dec.desc is filled with the description from the file
+header. Each completed row (desc.width * channels bytes; channels 0 means the
+number of channels from the header) is handed to the row callback together
+with its row number. The row callback must return 1 to continue or 0 to stop
+decoding. Bytes after the last pixel are ignored.
+
+qoi_decoder_init returns 0 on invalid parameters. qoi_decoder_push returns 0
+if the header is invalid, malloc failed or the row callback stopped decoding;
+all further calls fail then, too. qoi_decoder_finish returns 1 if all rows have
+been decoded, otherwise 0. qoi_decoder_finish must always be called after a
+successful qoi_decoder_init, to free the row buffer.
+
+
+Pull decoder. The same qoi_decoder can instead read its input on demand
+through a read callback and decode a given number of rows at a time into a
+caller supplied buffer:
+
+	qoi_decoder dec;
+	if (qoi_decoder_open(&dec, channels, my_read, my_user)) {
+		while ((n = qoi_decode_rows(&dec, rows, 16)) > 0) {
+			...
+		}
+		qoi_decoder_close(&dec);
+	}
+
+The read callback must return the number of bytes read into buf (at most len)
+or 0 at the end of the input or on error. Besides the qoi_decoder itself, only
+an input buffer of QOI_DECODER_BUFFER_SIZE bytes is used, regardless of the
+size of the image.
+
+qoi_decoder_open reads the header and returns 0 on failure (invalid
+parameters or header, or malloc failed); on success dec.desc is filled with the
+description from the file header. qoi_decode_rows decodes up to nrows rows
+into out (nrows * desc.width * channels bytes, tightly packed) and returns the
+number of rows decoded, which is only less than nrows at the end of the
+image or if the input ended early. Unlike qoi_decode, truncated input is not
+padded: qoi_decode_rows returns the rows that were complete before the input
+ended, sets dec.error and returns 0 on all further calls. qoi_decoder_close
+frees the input buffer. */
+
+typedef int (*qoi_row_fn)(void *user, const void *row, unsigned int y);
+typedef size_t (*qoi_read_fn)(void *user, void *buf, size_t len);
+
+typedef struct {
+	qoi_rgba_t index[64];
+	qoi_rgba_t px;
+	int run;
+} qoi_dec_state;
+
+typedef struct {
+	qoi_desc desc;
+	qoi_dec_state state;
+	unsigned char *(*decode)(
+		qoi_dec_state *s, const unsigned char **bytes_p,
+		const unsigned char *bytes_end,
+		unsigned char *pixels, unsigned char *pixels_end
+	);
+	qoi_row_fn row;
+	qoi_read_fn read;
+	void *user;
+	int channels;
+	unsigned char *buf;
+	size_t buf_pos;
+	size_t buf_len;
+	size_t row_len;
+	size_t row_pos;
+	unsigned int y;
+	unsigned char pending[16];
+	size_t pending_len;
+	int eof;
+	int error;
+} qoi_decoder;
+
+int qoi_decoder_init(qoi_decoder *dec, int channels, qoi_row_fn row, void *user);
+int qoi_decoder_push(qoi_decoder *dec, const void *data, size_t len);
+int qoi_decoder_finish(qoi_decoder *dec);
+
+int qoi_decoder_open(qoi_decoder *dec, int channels, qoi_read_fn read, void *user);
+unsigned int qoi_decode_rows(qoi_decoder *dec, void *out, unsigned int nrows);
+void qoi_decoder_close(qoi_decoder *dec);
+
+
+/* Encode or decode a whole image through user supplied I/O callbacks, e.g. to
+stream it to or from a socket, without a buffer for the encoded image.
+
+qoi_encode_io encodes raw RGB or RGBA pixels like qoi_encode64 and hands the
+encoded bytes to io->write, see qoi_encoder; io->read is not used. It returns
+the number of bytes written or 0 on failure (invalid parameters, the write
+callback failed or malloc failed).
+
+qoi_decode_io reads a QOI image through io->read, see qoi_decoder_open, and
+decodes it like qoi_decode64; io->write is not used. It either returns NULL on
+failure (invalid parameters or header, the input ended before the last pixel,
+or malloc failed) or a pointer to the
+decoded pixels, which should be free()d after use. On success, the qoi_desc
+struct is filled with the description from the file header. */
+
+typedef struct {
+	qoi_read_fn read;
+	qoi_write_fn write;
+	void *user;
+} qoi_io;
+
+size_t qoi_encode_io(const void *data, const qoi_desc *desc, const qoi_io *io);
+void *qoi_decode_io(const qoi_io *io, qoi_desc *desc, int channels);
+
+
+/* Seekable images. qoi_encode_seekable encodes raw RGB or RGBA pixels like
+qoi_encode64, and appends a seek index after the end marker. The seek index
+holds a checkpoint of the decoder state every rows_per_entry rows (0 picks a
+size of about 64k pixels per entry), each 276 bytes. Decoders stop at the end
+marker, so the image remains readable by any QOI decoder.
+
+qoi_decode_mt decodes an image from memory like qoi_decode64, using up to
+nthreads threads that each start at a checkpoint. Images without a seek index
+are decoded on the calling thread. Threads are only used if QOI_THREADS is
+defined, see qoi_encode_mt.
+
+qoi_decode_rows_at decodes only the rows y0 to y1 - 1 and returns
+(y1 - y0) * desc->width * channels bytes. With a seek index, decoding starts
+at the last checkpoint at or before y0; without, at the start of the image.
+
+All functions return NULL on failure (invalid parameters or data, or malloc
+failed). The returned data should be free()d after use. */
+
+void *qoi_encode_seekable(
+	const void *data, const qoi_desc *desc, unsigned int rows_per_entry,
+	size_t *out_len
+);
+void *qoi_decode_mt(
+	const void *data, size_t size, qoi_desc *desc, int channels, int nthreads
+);
+void *qoi_decode_rows_at(
+	const void *data, size_t size, qoi_desc *desc, int channels,
+	unsigned int y0, unsigned int y1
+);
+
+
+/* Decode only the w * h pixels rectangle at x, y of a QOI image from memory.
+All chunks up to the last pixel of the rectangle are still read, but pixels
+outside of it are not stored and only the rectangle is allocated. With a seek
+index (see qoi_encode_seekable), decoding starts at the last checkpoint at or
+before row y.
+
+The function either returns NULL on failure (invalid parameters or data, the
+rectangle is not within the image, or malloc failed) or a pointer to the
+w * h * channels bytes of decoded pixels. On success, the qoi_desc struct is
+filled with the description from the file header, i.e. of the whole image.
+
+The returned pixel data should be free()d after use. */
+
+void *qoi_decode_region(
+	const void *data, size_t size, qoi_desc *desc, int channels,
+	unsigned int x, unsigned int y, unsigned int w, unsigned int h
+);
+
+
+/* Decode a QOI image from memory and reduce it by a factor of scale (1, 2, 4
+or 8) on the fly, e.g. for thumbnails. Each output pixel is the average of a
+scale * scale block of the image; at the right and bottom edges the blocks may
+be smaller. Only the reduced image, one row of the image and one row of
+accumulators are allocated.
+
+The function either returns NULL on failure (invalid parameters or data, or
+malloc failed) or a pointer to the decoded pixels. The reduced image is
+desc->width / scale pixels wide and desc->height / scale pixels high, both
+rounded up, where the qoi_desc struct is filled with the description from the
+file header, i.e. of the full image.
+
+The returned pixel data should be free()d after use. */
+
+void *qoi_decode_scaled(
+	const void *data, size_t size, qoi_desc *desc, int channels, int scale
+);
+
+
+/* Tiled images. qoi_encode_tiled stores an image as independently encoded
+tiles of tile_size * tile_size pixels (0 picks 256); the tiles in the last
+column and row are smaller if the image size is not a multiple of tile_size.
+Each tile is a complete QOI image of its own, and a directory after the
+container header holds the offset of every tile. This is not a QOI file, but
+every tile can be decoded by any QOI decoder. The tiles are encoded using up
+to nthreads threads if QOI_THREADS is defined, see qoi_encode_mt. On success
+out_len is set to the size of the container.
+
+qoi_tiled_probe checks the container header, fills the qoi_desc struct with
+the description of the whole image and sets tile_size.
+
+qoi_decode_tiled decodes the whole image, using up to nthreads threads. The
+qoi_desc struct is filled with the description of the whole image.
+
+qoi_decode_tile decodes only the tile in column tx and row ty. It reads
+nothing but the container header, two directory entries and the tile itself,
+so it is cheap on a memory mapped file. The qoi_desc struct is filled with the
+description of the tile.
+
+The en-/decode functions return NULL on failure (invalid parameters or data,
+or malloc failed) and the returned data should be free()d after use;
+qoi_tiled_probe returns 0 on failure and 1 on success. */
+
+void *qoi_encode_tiled(
+	const void *data, const qoi_desc *desc, unsigned int tile_size,
+	int nthreads, size_t *out_len
+);
+int qoi_tiled_probe(
+	const void *data, size_t size, qoi_desc *desc, unsigned int *tile_size
+);
+void *qoi_decode_tiled(
+	const void *data, size_t size, qoi_desc *desc, int channels, int nthreads
+);
+void *qoi_decode_tile(
+	const void *data, size_t size, qoi_desc *desc, int channels,
+	unsigned int tx, unsigned int ty
+);
+
+
+/* Image sequences, e.g. recorded screen sessions or animations. A sequence
+holds any number of frames of the same size and channels. Keyframes are
+complete QOI images. Delta frames only encode the pixels that changed since
+the previous frame: they alternate between spans of pixels that are the same
+as in the previous frame, and spans of pixels encoded with the usual QOI ops.
+A directory at the end holds the offset of every frame for seeking. This is
+not a QOI file, but every keyframe can be decoded by any QOI decoder.
+
+	qoi_seq_encoder enc;
+	qoi_seq_encoder_init(&enc, &desc, 0, my_write, my_user);
+	for (...) {
+		qoi_seq_encoder_push(&enc, frame);
+	}
+	qoi_seq_encoder_finish(&enc);
+
+Every keyframe_interval-th frame is a keyframe (0 picks 60); the first frame
+always is. The encoder keeps a copy of the previous frame and writes through a
+QOI_ENCODER_BUFFER_SIZE buffer like qoi_encoder, see there for the write
+callback and the return values. qoi_seq_encoder_finish writes the directory
+and must always be called after a successful qoi_seq_encoder_init; enc.enc.size
+then holds the total number of bytes written.
+
+	qoi_seq_decoder dec;
+	if (qoi_seq_decoder_open(&dec, data, size, channels)) {
+		for (k = 0; k < dec.frames; k++) {
+			const void *pixels = qoi_seq_decode_frame(&dec, k);
+			...
+		}
+		qoi_seq_decoder_close(&dec);
+	}
+
+The decoder works on the whole sequence in memory, which may be a memory
+mapped file. qoi_seq_decoder_open returns 0 on failure (invalid parameters or
+data, or malloc failed); on success dec.desc is filled with the description of
+the frames and dec.frames with their number. qoi_seq_decode_frame returns the
+pixels of frame k, or NULL if the frame is invalid. The pixels belong to the
+decoder and are only valid until the next call. Decoding the next frame only
+applies its changes; any other frame is decoded starting at the keyframe
+before it. qoi_seq_decoder_close frees the frame buffer. */
+
+typedef struct {
+	qoi_encoder enc;
+	unsigned char *prev;
+	size_t *offsets;
+	unsigned int frames;
+	unsigned int frames_cap;
+	unsigned int keyframe_interval;
+} qoi_seq_encoder;
+
+typedef struct {
+	qoi_desc desc;
+	const unsigned char *data;
+	size_t size;
+	const unsigned char *dir;
+	unsigned int frames;
+	unsigned int current;
+	int channels;
+	unsigned char *pixels;
+} qoi_seq_decoder;
+
+int qoi_seq_encoder_init(
+	qoi_seq_encoder *enc, const qoi_desc *desc, unsigned int keyframe_interval,
+	qoi_write_fn write, void *user
+);
+int qoi_seq_encoder_push(qoi_seq_encoder *enc, const void *frame);
+int qoi_seq_encoder_finish(qoi_seq_encoder *enc);
+
+int qoi_seq_decoder_open(
+	qoi_seq_decoder *dec, const void *data, size_t size, int channels
+);
+const void *qoi_seq_decode_frame(qoi_seq_decoder *dec, unsigned int k);
+void qoi_seq_decoder_close(qoi_seq_decoder *dec);
+
+
 #ifdef __cplusplus
 }
 #endif
@@ -330,6 +1004,91 @@ Implementation */
 #ifndef QOI_ZEROARR
 	#define QOI_ZEROARR(a) memset((a),0,sizeof(a))
 #endif
+#if defined(_MSC_VER)
+	#define QOI_INLINE __forceinline
+#elif defined(__GNUC__)
+	#define QOI_INLINE inline __attribute__((always_inline))
+#else
+	#define QOI_INLINE inline
+#endif
+#ifndef QOI_ENCODER_BUFFER_SIZE
+	#define QOI_ENCODER_BUFFER_SIZE (64 * 1024)
+#endif
+#ifndef QOI_DECODER_BUFFER_SIZE
+	#define QOI_DECODER_BUFFER_SIZE (64 * 1024)
+#endif
+/* Buffers for qoi_read_direct; the size must be a multiple of 4096 */
+#ifndef QOI_READ_AHEAD_SIZE
+	#define QOI_READ_AHEAD_SIZE (1024 * 1024)
+#endif
+#ifndef QOI_READ_AHEAD_BUFFERS
+	#define QOI_READ_AHEAD_BUFFERS 4
+#endif
+
+/* SSE2 is used to find the end of runs in the encoder. It's part of every
+x86_64 CPU, so it is enabled by default there. AVX2 is only used if the
+compiler has been told it's available (e.g. -mavx2). Define QOI_NO_SIMD to
+always use the plain C loop. */
+#ifndef QOI_NO_SIMD
+	#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+		#define QOI_SSE2
+		#include <emmintrin.h>
+	#endif
+	#if defined(QOI_SSE2) && defined(__AVX2__)
+		#define QOI_AVX2
+		#include <immintrin.h>
+	#endif
+#endif
+
+/* Some POSIX functions are used where available. Strict ISO C modes (e.g.
+-std=c99) hide their declarations, unless a POSIX or X/Open feature macro is
+defined; define QOI_NO_POSIX to never use them. */
+#if \
+	!defined(QOI_NO_POSIX) && !defined(_WIN32) && \
+	(defined(__unix__) || defined(__APPLE__)) && ( \
+		!defined(__STRICT_ANSI__) || defined(_GNU_SOURCE) || \
+		defined(_XOPEN_SOURCE) || \
+		(defined(_POSIX_C_SOURCE) && _POSIX_C_SOURCE >= 200809L) \
+	)
+	#define QOI_POSIX
+#endif
+
+/* Threads are opt-in, so that including this library doesn't require
+linking with -pthread. QOI_NO_THREADS overrides QOI_THREADS. */
+#if !defined(QOI_THREADS) && !defined(QOI_NO_THREADS)
+	#define QOI_NO_THREADS
+#endif
+
+/* windows.h is only needed for the timer of QOI_STATS and for threads. Keep
+its min/max macros and most of its declarations out of the including file. */
+#if defined(_WIN32) && (defined(QOI_STATS) || !defined(QOI_NO_THREADS))
+	#ifndef WIN32_LEAN_AND_MEAN
+		#define WIN32_LEAN_AND_MEAN
+		#define QOI_UNDEF_WIN32_LEAN_AND_MEAN
+	#endif
+	#ifndef NOMINMAX
+		#define NOMINMAX
+		#define QOI_UNDEF_NOMINMAX
+	#endif
+	#include <windows.h>
+	#ifdef QOI_UNDEF_WIN32_LEAN_AND_MEAN
+		#undef WIN32_LEAN_AND_MEAN
+		#undef QOI_UNDEF_WIN32_LEAN_AND_MEAN
+	#endif
+	#ifdef QOI_UNDEF_NOMINMAX
+		#undef NOMINMAX
+		#undef QOI_UNDEF_NOMINMAX
+	#endif
+#endif
+
+#if defined(QOI_STATS) && !defined(_WIN32)
+	#include <time.h>
+#endif
+
+/* Threads use pthreads, or Win32 threads on Windows */
+#if !defined(QOI_NO_THREADS) && !defined(_WIN32)
+	#include <pthread.h>
+#endif
 
 #define QOI_OP_INDEX  0x00 /* 00xxxxxx */
 #define QOI_OP_DIFF   0x40 /* 01xxxxxx */
@@ -346,19 +1105,29 @@ Implementation */
 	 ((unsigned int)'i') <<  8 | ((unsigned int)'f'))
 #define QOI_HEADER_SIZE 14
 
-/* 2GB is the max file size that this implementation can safely handle. We guard
-against anything larger than that, assuming the worst case with 5 bytes per 
-pixel, rounded down to a nice clean value. 400 million pixels ought to be 
-enough for anybody. */
+/* 2GB is the max file size that the int based functions (qoi_encode,
+qoi_decode, qoi_read and qoi_write) can safely handle. We guard against
+anything larger than that, assuming the worst case with 5 bytes per pixel,
+rounded down to a nice clean value. The size_t based functions only require
+that the worst case encoded size fits into a size_t. */
 #define QOI_PIXELS_MAX ((unsigned int)400000000)
-
-typedef union {
-	struct { unsigned char r, g, b, a; } rgba;
-	unsigned int v;
-} qoi_rgba_t;
+#define QOI_SIZE_MAX ((size_t)-1)
 
 static const unsigned char qoi_padding[8] = {0,0,0,0,0,0,0,1};
 
+static void *qoi_alloc(const qoi_allocator *allocator, size_t size) {
+	return allocator ? allocator->alloc(allocator->user, size) : QOI_MALLOC(size);
+}
+
+static void qoi_free(const qoi_allocator *allocator, void *ptr) {
+	if (allocator) {
+		allocator->free(allocator->user, ptr);
+	}
+	else {
+		QOI_FREE(ptr);
+	}
+}
+
 void qoi_write_32(unsigned char *bytes, int *p, unsigned int v) {
 	bytes[(*p)++] = (0xff000000 & v) >> 24;
 	bytes[(*p)++] = (0x00ff0000 & v) >> 16;
@@ -374,85 +1143,398 @@ unsigned int qoi_read_32(const unsigned char *bytes, int *p) {
 	return a << 24 | b << 16 | c << 8 | d;
 }
 
-void *qoi_encode(const void *data, const qoi_desc *desc, int *out_len) {
-	int i, max_size, p, run;
-	int px_len, px_end, px_pos, channels;
-	unsigned char *bytes;
-	const unsigned char *pixels;
-	qoi_rgba_t index[64];
-	qoi_rgba_t px, px_prev;
+/* Minimal thread wrapper: qoi_parallel() runs fn on each of the njobs jobs,
+each on its own thread, and returns once all of them are done. The last job
+runs on the calling thread. If a thread can't be started, its job runs on the
+calling thread as well. */
+typedef void (*qoi_job_fn)(void *job);
 
-	if (
-		data == NULL || out_len == NULL || desc == NULL ||
-		desc->width == 0 || desc->height == 0 ||
-		desc->channels < 3 || desc->channels > 4 ||
-		desc->colorspace > 1 ||
-		desc->height >= QOI_PIXELS_MAX / desc->width
-	) {
-		return NULL;
+typedef struct {
+	qoi_job_fn fn;
+	void *job;
+	int started;
+#ifndef QOI_NO_THREADS
+	#ifdef _WIN32
+		HANDLE handle;
+	#else
+		pthread_t handle;
+	#endif
+#endif
+} qoi_thread;
+
+#ifndef QOI_NO_THREADS
+#ifdef _WIN32
+static DWORD WINAPI qoi_thread_main(LPVOID arg) {
+	qoi_thread *t = (qoi_thread *)arg;
+	t->fn(t->job);
+	return 0;
+}
+#else
+static void *qoi_thread_main(void *arg) {
+	qoi_thread *t = (qoi_thread *)arg;
+	t->fn(t->job);
+	return NULL;
+}
+#endif
+#endif
+
+/* Try to run fn(job) on a new thread; returns 0 if no thread was started */
+static int qoi_thread_spawn(qoi_thread *t, qoi_job_fn fn, void *job) {
+	t->fn = fn;
+	t->job = job;
+	t->started = 0;
+#ifndef QOI_NO_THREADS
+	#ifdef _WIN32
+		t->handle = CreateThread(NULL, 0, qoi_thread_main, t, 0, NULL);
+		t->started = t->handle != NULL;
+	#else
+		t->started = pthread_create(&t->handle, NULL, qoi_thread_main, t) == 0;
+	#endif
+#endif
+	return t->started;
+}
+
+static void qoi_thread_start(qoi_thread *t, qoi_job_fn fn, void *job) {
+	if (!qoi_thread_spawn(t, fn, job)) {
+		fn(job);
 	}
+}
 
-	max_size =
-		desc->width * desc->height * (desc->channels + 1) + 
-		QOI_HEADER_SIZE + sizeof(qoi_padding);
+static void qoi_thread_join(qoi_thread *t) {
+	if (!t->started) {
+		return;
+	}
+#ifndef QOI_NO_THREADS
+	#ifdef _WIN32
+		WaitForSingleObject(t->handle, INFINITE);
+		CloseHandle(t->handle);
+	#else
+		pthread_join(t->handle, NULL);
+	#endif
+#endif
+	t->started = 0;
+}
 
-	p = 0;
-	bytes = (unsigned char *) QOI_MALLOC(max_size);
-	if (!bytes) {
-		return NULL;
+static void qoi_parallel(qoi_job_fn fn, void *jobs, size_t job_size, int njobs) {
+	qoi_thread *threads = NULL;
+	int i;
+
+	if (njobs > 1) {
+		threads = (qoi_thread *) QOI_MALLOC(sizeof(qoi_thread) * (njobs - 1));
+	}
+	for (i = 0; i < njobs - 1; i++) {
+		if (threads) {
+			qoi_thread_start(&threads[i], fn, (char *)jobs + i * job_size);
+		}
+		else {
+			fn((char *)jobs + i * job_size);
+		}
+	}
+	fn((char *)jobs + (njobs - 1) * job_size);
+	if (threads) {
+		for (i = 0; i < njobs - 1; i++) {
+			qoi_thread_join(&threads[i]);
+		}
+		QOI_FREE(threads);
+	}
+}
+
+#ifdef QOI_SSE2
+#if defined(_MSC_VER) && !defined(__clang__)
+	#include <intrin.h>
+	static int qoi_ctz(unsigned int v) {
+		unsigned long i;
+		_BitScanForward(&i, v);
+		return (int)i;
+	}
+#else
+	#define qoi_ctz(v) __builtin_ctz(v)
+#endif
+
+/* Return the number of consecutive pixels starting at p that have the same
+bytes as the pixel at ref, without reading past end. For 4 byte pixels only the
+bytes set in mask are compared. 4 (SSE2) or 8 (AVX2) 4 byte pixels are compared
+per step; 3 byte pixels are compared 16 at a time against a 48 byte pattern. */
+static size_t qoi_run_length(
+	const unsigned char *p, const unsigned char *end,
+	const unsigned char *ref, int bpp, unsigned int mask
+) {
+	const unsigned char *start = p;
+	unsigned int m;
+
+	if (bpp == 4) {
+		unsigned int v, w;
+		__m128i v4, mask4;
+
+		memcpy(&v, ref, 4);
+		v &= mask;
+		v4 = _mm_set1_epi32((int)v);
+		mask4 = _mm_set1_epi32((int)mask);
+		#ifdef QOI_AVX2
+		{
+			__m256i v8 = _mm256_set1_epi32((int)v);
+			__m256i mask8 = _mm256_set1_epi32((int)mask);
+			while (end - p >= 32) {
+				m = ~(unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi32(
+					_mm256_and_si256(_mm256_loadu_si256((const __m256i *)p), mask8), v8
+				));
+				if (m) {
+					return ((size_t)(p - start) + qoi_ctz(m)) / 4;
+				}
+				p += 32;
+			}
+		}
+		#endif
+		while (end - p >= 16) {
+			m = ~_mm_movemask_epi8(_mm_cmpeq_epi32(
+				_mm_and_si128(_mm_loadu_si128((const __m128i *)p), mask4), v4
+			)) & 0xffff;
+			if (m) {
+				return ((size_t)(p - start) + qoi_ctz(m)) / 4;
+			}
+			p += 16;
+		}
+		while (p < end) {
+			memcpy(&w, p, 4);
+			if ((w & mask) != v) {
+				break;
+			}
+			p += 4;
+		}
+	}
+	else {
+		unsigned char pattern[48];
+		__m128i v0, v1, v2;
+		int i;
+
+		if (end - p < 3 || p[0] != ref[0] || p[1] != ref[1] || p[2] != ref[2]) {
+			return 0;
+		}
+		for (i = 0; i < 48; i += 3) {
+			pattern[i + 0] = ref[0];
+			pattern[i + 1] = ref[1];
+			pattern[i + 2] = ref[2];
+		}
+		v0 = _mm_loadu_si128((const __m128i *)(pattern +  0));
+		v1 = _mm_loadu_si128((const __m128i *)(pattern + 16));
+		v2 = _mm_loadu_si128((const __m128i *)(pattern + 32));
+
+		while (end - p >= 48) {
+			m = ~_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p +  0)), v0)) & 0xffff;
+			if (m) { return ((size_t)(p - start) +  0 + qoi_ctz(m)) / 3; }
+			m = ~_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p + 16)), v1)) & 0xffff;
+			if (m) { return ((size_t)(p - start) + 16 + qoi_ctz(m)) / 3; }
+			m = ~_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p + 32)), v2)) & 0xffff;
+			if (m) { return ((size_t)(p - start) + 32 + qoi_ctz(m)) / 3; }
+			p += 48;
+		}
+		while (p < end && p[0] == ref[0] && p[1] == ref[1] && p[2] == ref[2]) {
+			p += 3;
+		}
+	}
+	return (size_t)(p - start) / bpp;
+}
+#endif /* QOI_SSE2 */
+
+#ifdef QOI_STATS
+static unsigned long long qoi_stats_now(void) {
+#if defined(_WIN32)
+	LARGE_INTEGER freq, count;
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&count);
+	return (unsigned long long)(count.QuadPart / (double)freq.QuadPart * 1e9);
+#elif defined(QOI_POSIX)
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+#else
+	return (unsigned long long)(clock() / (double)CLOCKS_PER_SEC * 1e9);
+#endif
+}
+
+static void qoi_stats_add_run(qoi_stats *stats, size_t run) {
+	int bucket = 0;
+	while (run > 1 && bucket < QOI_STATS_RUN_BUCKETS - 1) {
+		run >>= 1;
+		bucket++;
+	}
+	stats->runs[bucket]++;
+}
+
+/* Count the chunks in bytes..bytes_end. The time_ns is left untouched. */
+static void qoi_stats_collect(
+	qoi_stats *stats, const unsigned char *bytes, const unsigned char *bytes_end
+) {
+	static const unsigned char len[QOI_STAT_OPS] = {1, 1, 2, 1, 4, 5};
+	size_t run = 0, other;
+	int op;
+
+	memset(stats->chunks, 0, sizeof(stats->chunks));
+	memset(stats->bytes, 0, sizeof(stats->bytes));
+	memset(stats->runs, 0, sizeof(stats->runs));
+	stats->pixels = 0;
+
+	while (bytes < bytes_end) {
+		int b1 = bytes[0];
+
+		if (b1 == QOI_OP_RGB) {
+			op = QOI_STAT_RGB;
+		}
+		else if (b1 == QOI_OP_RGBA) {
+			op = QOI_STAT_RGBA;
+		}
+		else if ((b1 & QOI_MASK_2) == QOI_OP_INDEX) {
+			op = QOI_STAT_INDEX;
+		}
+		else if ((b1 & QOI_MASK_2) == QOI_OP_DIFF) {
+			op = QOI_STAT_DIFF;
+		}
+		else if ((b1 & QOI_MASK_2) == QOI_OP_LUMA) {
+			op = QOI_STAT_LUMA;
+		}
+		else {
+			op = QOI_STAT_RUN;
+		}
+
+		if (bytes_end - bytes < len[op]) {
+			break;
+		}
+		bytes += len[op];
+		stats->chunks[op]++;
+		stats->bytes[op] += len[op];
+
+		if (op == QOI_STAT_RUN) {
+			run += (b1 & 0x3f) + 1;
+			continue;
+		}
+		if (run) {
+			qoi_stats_add_run(stats, run);
+			stats->pixels += run;
+			run = 0;
+		}
+		stats->pixels++;
 	}
+	if (run) {
+		qoi_stats_add_run(stats, run);
+		stats->pixels += run;
+	}
+
+	other = stats->chunks[QOI_STAT_INDEX] + stats->chunks[QOI_STAT_DIFF] +
+		stats->chunks[QOI_STAT_LUMA] + stats->chunks[QOI_STAT_RGB] +
+		stats->chunks[QOI_STAT_RGBA];
+	stats->index_hit_rate = other
+		? stats->chunks[QOI_STAT_INDEX] / (double)other
+		: 0.0;
+}
+#endif /* QOI_STATS */
+
+static int qoi_valid_desc(const qoi_desc *desc) {
+	return
+		desc != NULL &&
+		desc->width != 0 && desc->height != 0 &&
+		desc->channels >= 3 && desc->channels <= 4 &&
+		desc->colorspace <= 1 &&
+		desc->height <= (QOI_SIZE_MAX - QOI_HEADER_SIZE - 8) / 5 / desc->width;
+}
+
+static int qoi_within_pixels_max(const qoi_desc *desc) {
+	return desc->height < QOI_PIXELS_MAX / desc->width;
+}
 
+static void qoi_enc_init(qoi_enc_state *s) {
+	QOI_ZEROARR(s->index);
+	s->run = 0;
+	s->px_prev.rgba.r = 0;
+	s->px_prev.rgba.g = 0;
+	s->px_prev.rgba.b = 0;
+	s->px_prev.rgba.a = 255;
+}
+
+static unsigned char *qoi_enc_header(unsigned char *bytes, const qoi_desc *desc) {
+	int p = 0;
 	qoi_write_32(bytes, &p, QOI_MAGIC);
 	qoi_write_32(bytes, &p, desc->width);
 	qoi_write_32(bytes, &p, desc->height);
 	bytes[p++] = desc->channels;
 	bytes[p++] = desc->colorspace;
+	return bytes + p;
+}
 
+/* Encode the pixels in [pixels, pixels_end) and return the new write position.
+A run that is still going at pixels_end is kept in s->run, so that the next
+call can continue it; qoi_enc_flush() must be called after the last pixel.
+The caller has to provide room for QOI_ENC_WORST_CASE(npx, channels) bytes.
+
+The source pixels are bpp bytes wide, with the red, green, blue and alpha
+channels at byte offsets ro, go, bo and ao. An ao < 0 means the source has no
+alpha (or it should be ignored) and all pixels are opaque. This function is
+always inlined with constant layout arguments; see QOI_ENC_SPECIALIZE below. */
+#define QOI_ENC_WORST_CASE(npx, channels) ((npx) * ((channels) + 1) + 1)
+
+static QOI_INLINE unsigned char *qoi_enc_pixels(
+	qoi_enc_state *s, const unsigned char *pixels, const unsigned char *pixels_end,
+	unsigned char *bytes, const int bpp,
+	const int ro, const int go, const int bo, const int ao
+) {
+	qoi_rgba_t *index = s->index;
+	qoi_rgba_t px, px_prev;
+	int run;
 
-	pixels = (const unsigned char *)data;
-
-	QOI_ZEROARR(index);
-
-	run = 0;
-	px_prev.rgba.r = 0;
-	px_prev.rgba.g = 0;
-	px_prev.rgba.b = 0;
-	px_prev.rgba.a = 255;
+	run = s->run;
+	px_prev = s->px_prev;
 	px = px_prev;
-	
-	px_len = desc->width * desc->height * desc->channels;
-	px_end = px_len - desc->channels;
-	channels = desc->channels;
 
-	for (px_pos = 0; px_pos < px_len; px_pos += channels) {
-		if (channels == 4) {
-			px = *(qoi_rgba_t *)(pixels + px_pos);
+	for (; pixels < pixels_end; pixels += bpp) {
+		if (bpp == 4 && ro == 0 && go == 1 && bo == 2 && ao == 3) {
+			memcpy(&px, pixels, 4);
 		}
 		else {
-			px.rgba.r = pixels[px_pos + 0];
-			px.rgba.g = pixels[px_pos + 1];
-			px.rgba.b = pixels[px_pos + 2];
+			px.rgba.r = pixels[ro];
+			px.rgba.g = pixels[go];
+			px.rgba.b = pixels[bo];
+			if (ao >= 0) {
+				px.rgba.a = pixels[ao];
+			}
 		}
 
 		if (px.v == px_prev.v) {
+		#ifdef QOI_SSE2
+			/* Swallow the whole run and emit all full QOI_OP_RUNs at once. The
+			remainder is flushed by the next (different) pixel or, at the end
+			of the image, by qoi_enc_flush(). */
+			qoi_rgba_t mask;
+			size_t n;
+
+			mask.v = 0xffffffff;
+			if (bpp == 4 && ao < 0) {
+				((unsigned char *)&mask)[6 - ro - go - bo] = 0;
+			}
+			n = qoi_run_length(pixels + bpp, pixels_end, pixels, bpp, mask.v);
+			pixels += n * bpp;
+			for (n += run + 1; n >= 62; n -= 62) {
+				*bytes++ = QOI_OP_RUN | 61;
+			}
+			run = (int)n;
+		#else
 			run++;
-			if (run == 62 || px_pos == px_end) {
-				bytes[p++] = QOI_OP_RUN | (run - 1);
+			if (run == 62) {
+				*bytes++ = QOI_OP_RUN | (run - 1);
 				run = 0;
 			}
+		#endif
 		}
 		else {
 			int index_pos;
 
 			if (run > 0) {
-				bytes[p++] = QOI_OP_RUN | (run - 1);
+				*bytes++ = QOI_OP_RUN | (run - 1);
 				run = 0;
 			}
 
 			index_pos = QOI_COLOR_HASH(px) % 64;
 
 			if (index[index_pos].v == px.v) {
-				bytes[p++] = QOI_OP_INDEX | index_pos;
+				*bytes++ = QOI_OP_INDEX | index_pos;
 			}
 			else {
 				index[index_pos] = px;
@@ -470,143 +1552,2866 @@ void *qoi_encode(const void *data, const qoi_desc *desc, int *out_len) {
 						vg > -3 && vg < 2 && 
 						vb > -3 && vb < 2
 					) {
-						bytes[p++] = QOI_OP_DIFF | (vr + 2) << 4 | (vg + 2) << 2 | (vb + 2);
+						*bytes++ = QOI_OP_DIFF | (vr + 2) << 4 | (vg + 2) << 2 | (vb + 2);
 					}
 					else if (
 						vg_r >  -9 && vg_r <  8 &&
 						vg   > -33 && vg   < 32 &&
 						vg_b >  -9 && vg_b <  8
 					) {
-						bytes[p++] = QOI_OP_LUMA     | (vg   + 32);
-						bytes[p++] = (vg_r + 8) << 4 | (vg_b +  8);
+						*bytes++ = QOI_OP_LUMA     | (vg   + 32);
+						*bytes++ = (vg_r + 8) << 4 | (vg_b +  8);
 					}
 					else {
-						bytes[p++] = QOI_OP_RGB;
-						bytes[p++] = px.rgba.r;
-						bytes[p++] = px.rgba.g;
-						bytes[p++] = px.rgba.b;
+						*bytes++ = QOI_OP_RGB;
+						*bytes++ = px.rgba.r;
+						*bytes++ = px.rgba.g;
+						*bytes++ = px.rgba.b;
 					}
 				}
 				else {
-					bytes[p++] = QOI_OP_RGBA;
-					bytes[p++] = px.rgba.r;
-					bytes[p++] = px.rgba.g;
-					bytes[p++] = px.rgba.b;
-					bytes[p++] = px.rgba.a;
+					*bytes++ = QOI_OP_RGBA;
+					*bytes++ = px.rgba.r;
+					*bytes++ = px.rgba.g;
+					*bytes++ = px.rgba.b;
+					*bytes++ = px.rgba.a;
 				}
 			}
 		}
 		px_prev = px;
 	}
 
-	for (i = 0; i < sizeof(qoi_padding); i++) {
-		bytes[p++] = qoi_padding[i];
-	}
-
-	*out_len = p;
+	s->px_prev = px_prev;
+	s->run = run;
 	return bytes;
 }
 
-void *qoi_decode(const void *data, int size, qoi_desc *desc, int channels) {
-	const unsigned char *bytes;
-	unsigned int header_magic;
-	unsigned char *pixels;
-	qoi_rgba_t index[64];
-	qoi_rgba_t px;
-	int px_len, chunks_len, px_pos;
-	int p = 0, run = 0;
+#define QOI_ENC_SPECIALIZE(NAME, BPP, RO, GO, BO, AO) \
+	static unsigned char *NAME( \
+		qoi_enc_state *s, const unsigned char *pixels, \
+		const unsigned char *pixels_end, unsigned char *bytes \
+	) { \
+		return qoi_enc_pixels(s, pixels, pixels_end, bytes, BPP, RO, GO, BO, AO); \
+	}
 
-	if (
-		data == NULL || desc == NULL ||
-		(channels != 0 && channels != 3 && channels != 4) ||
-		size < QOI_HEADER_SIZE + sizeof(qoi_padding)
-	) {
-		return NULL;
+QOI_ENC_SPECIALIZE(qoi_enc_rgba, 4, 0, 1, 2,  3)
+QOI_ENC_SPECIALIZE(qoi_enc_rgbx, 4, 0, 1, 2, -1)
+QOI_ENC_SPECIALIZE(qoi_enc_bgra, 4, 2, 1, 0,  3)
+QOI_ENC_SPECIALIZE(qoi_enc_bgrx, 4, 2, 1, 0, -1)
+QOI_ENC_SPECIALIZE(qoi_enc_argb, 4, 1, 2, 3,  0)
+QOI_ENC_SPECIALIZE(qoi_enc_xrgb, 4, 1, 2, 3, -1)
+QOI_ENC_SPECIALIZE(qoi_enc_rgb,  3, 0, 1, 2, -1)
+QOI_ENC_SPECIALIZE(qoi_enc_bgr,  3, 2, 1, 0, -1)
+
+typedef unsigned char *(*qoi_enc_fn)(
+	qoi_enc_state *s, const unsigned char *pixels,
+	const unsigned char *pixels_end, unsigned char *bytes
+);
+
+/* Select the encoder loop for a source layout and the number of channels that
+are stored. Returns NULL for an unknown layout. */
+static qoi_enc_fn qoi_enc_select(int layout, int channels, int *bpp) {
+	*bpp = 4;
+	switch (layout) {
+		case QOI_LAYOUT_RGBA: return channels == 4 ? qoi_enc_rgba : qoi_enc_rgbx;
+		case QOI_LAYOUT_BGRA: return channels == 4 ? qoi_enc_bgra : qoi_enc_bgrx;
+		case QOI_LAYOUT_ARGB: return channels == 4 ? qoi_enc_argb : qoi_enc_xrgb;
+		case QOI_LAYOUT_RGBX: return qoi_enc_rgbx;
+		case QOI_LAYOUT_RGB:  *bpp = 3; return qoi_enc_rgb;
+		case QOI_LAYOUT_BGR:  *bpp = 3; return qoi_enc_bgr;
+		default: return NULL;
 	}
+}
 
-	bytes = (const unsigned char *)data;
+#define QOI_LAYOUT_OF(channels) ((channels) == 4 ? QOI_LAYOUT_RGBA : QOI_LAYOUT_RGB)
 
-	header_magic = qoi_read_32(bytes, &p);
-	desc->width = qoi_read_32(bytes, &p);
-	desc->height = qoi_read_32(bytes, &p);
-	desc->channels = bytes[p++];
+static unsigned char *qoi_enc_flush(qoi_enc_state *s, unsigned char *bytes) {
+	if (s->run > 0) {
+		*bytes++ = QOI_OP_RUN | (s->run - 1);
+		s->run = 0;
+	}
+	return bytes;
+}
+
+size_t qoi_encode_bound(const qoi_desc *desc) {
+	if (!qoi_valid_desc(desc)) {
+		return 0;
+	}
+	return
+		(size_t)desc->width * desc->height * (desc->channels + 1) +
+		QOI_HEADER_SIZE + sizeof(qoi_padding);
+}
+
+/* Number of pixels qoi_encode_into() encodes at once when the output buffer is
+smaller than qoi_encode_bound(). */
+#define QOI_ENC_SLICE_PX 1024
+
+int qoi_encode_into(
+	const void *data, const qoi_desc *desc,
+	void *out, size_t out_cap, size_t *out_len
+) {
+	unsigned char *bytes, *bytes_end;
+	const unsigned char *pixels, *pixels_end;
+	qoi_enc_state s;
+	qoi_enc_fn encode;
+	int channels, bpp;
+
+	if (
+		data == NULL || out == NULL || out_len == NULL ||
+		!qoi_valid_desc(desc) ||
+		out_cap < QOI_HEADER_SIZE + sizeof(qoi_padding)
+	) {
+		return 0;
+	}
+
+	bytes = qoi_enc_header((unsigned char *)out, desc);
+	bytes_end = (unsigned char *)out + out_cap - sizeof(qoi_padding);
+	pixels = (const unsigned char *)data;
+	channels = desc->channels;
+	pixels_end = pixels + (size_t)desc->width * desc->height * channels;
+	encode = qoi_enc_select(QOI_LAYOUT_OF(channels), channels, &bpp);
+	qoi_enc_init(&s);
+
+	if (out_cap >= qoi_encode_bound(desc)) {
+		bytes = encode(&s, pixels, pixels_end, bytes);
+	}
+	else {
+		/* Encode slice by slice. A slice goes straight into the output if even
+		its worst case fits, otherwise through a scratch buffer that is only
+		copied over if the actual encoding fits. */
+		unsigned char scratch[QOI_ENC_WORST_CASE(QOI_ENC_SLICE_PX, 4)];
+		while (pixels < pixels_end) {
+			const unsigned char *slice_end = pixels + QOI_ENC_SLICE_PX * channels;
+			if (slice_end > pixels_end) {
+				slice_end = pixels_end;
+			}
+
+			if (bytes_end - bytes >= QOI_ENC_WORST_CASE(QOI_ENC_SLICE_PX, channels)) {
+				bytes = encode(&s, pixels, slice_end, bytes);
+			}
+			else {
+				size_t len = encode(&s, pixels, slice_end, scratch) - scratch;
+				if (len > (size_t)(bytes_end - bytes)) {
+					return 0;
+				}
+				memcpy(bytes, scratch, len);
+				bytes += len;
+			}
+			pixels = slice_end;
+		}
+		if (s.run > 0 && bytes == bytes_end) {
+			return 0;
+		}
+	}
+
+	bytes = qoi_enc_flush(&s, bytes);
+	memcpy(bytes, qoi_padding, sizeof(qoi_padding));
+	bytes += sizeof(qoi_padding);
+
+	*out_len = bytes - (unsigned char *)out;
+	return 1;
+}
+
+static int qoi_encoder_flush(qoi_encoder *enc) {
+	if (enc->buf_len > 0 && !enc->error) {
+		if (!enc->write(enc->user, enc->buf, enc->buf_len)) {
+			enc->error = 1;
+		}
+		enc->size += enc->buf_len;
+	}
+	enc->buf_len = 0;
+	return !enc->error;
+}
+
+/* Set up everything but the header; the buffer starts out empty */
+static int qoi_encoder_setup(
+	qoi_encoder *enc, const qoi_desc *desc, qoi_write_fn write, void *user
+) {
+	int bpp;
+
+	if (enc == NULL || write == NULL || !qoi_valid_desc(desc)) {
+		return 0;
+	}
+
+	enc->buf = (unsigned char *) QOI_MALLOC(QOI_ENCODER_BUFFER_SIZE);
+	if (!enc->buf) {
+		return 0;
+	}
+
+	enc->desc = *desc;
+	enc->write = write;
+	enc->user = user;
+	enc->size = 0;
+	enc->rows = 0;
+	enc->error = 0;
+	enc->encode = qoi_enc_select(QOI_LAYOUT_OF(desc->channels), desc->channels, &bpp);
+	qoi_enc_init(&enc->state);
+	enc->buf_len = 0;
+	return 1;
+}
+
+int qoi_encoder_init(
+	qoi_encoder *enc, const qoi_desc *desc, qoi_write_fn write, void *user
+) {
+	if (!qoi_encoder_setup(enc, desc, write, user)) {
+		return 0;
+	}
+	enc->buf_len = qoi_enc_header(enc->buf, desc) - enc->buf;
+	return 1;
+}
+
+/* Return a pointer to more than n free bytes in the buffer, flushing it first
+if necessary, or NULL if the write callback failed */
+static unsigned char *qoi_encoder_reserve(qoi_encoder *enc, size_t n) {
+	if (enc->buf_len + n >= QOI_ENCODER_BUFFER_SIZE && !qoi_encoder_flush(enc)) {
+		return NULL;
+	}
+	return enc->error ? NULL : enc->buf + enc->buf_len;
+}
+
+/* Encode the pixels up to pixels_end, flushing the buffer as it fills up */
+static int qoi_encoder_push(
+	qoi_encoder *enc, const unsigned char *pixels, const unsigned char *pixels_end
+) {
+	int channels = enc->desc.channels;
+
+	while (pixels < pixels_end) {
+		const unsigned char *slice_end;
+		size_t npx = (QOI_ENCODER_BUFFER_SIZE - enc->buf_len - 1) / (channels + 1);
+
+		/* Don't bother encoding tiny slices; flush first */
+		if (npx < 64) {
+			if (!qoi_encoder_flush(enc)) {
+				return 0;
+			}
+			npx = (QOI_ENCODER_BUFFER_SIZE - 1) / (channels + 1);
+		}
+
+		slice_end = pixels + npx * channels;
+		if (slice_end > pixels_end || slice_end < pixels) {
+			slice_end = pixels_end;
+		}
+		enc->buf_len = enc->encode(
+			&enc->state, pixels, slice_end, enc->buf + enc->buf_len
+		) - enc->buf;
+		pixels = slice_end;
+	}
+	return 1;
+}
+
+int qoi_encoder_push_rows(qoi_encoder *enc, const void *rows, unsigned int nrows) {
+	const unsigned char *pixels = (const unsigned char *)rows;
+
+	if (enc->error || rows == NULL || nrows > enc->desc.height - enc->rows) {
+		enc->error = 1;
+		return 0;
+	}
+
+	if (!qoi_encoder_push(
+		enc, pixels, pixels + (size_t)enc->desc.width * nrows * enc->desc.channels
+	)) {
+		return 0;
+	}
+	enc->rows += nrows;
+	return 1;
+}
+
+int qoi_encoder_finish(qoi_encoder *enc) {
+	unsigned char *bytes;
+
+	if (enc->rows != enc->desc.height) {
+		enc->error = 1;
+	}
+
+	if (
+		!enc->error &&
+		enc->buf_len + 1 + sizeof(qoi_padding) > QOI_ENCODER_BUFFER_SIZE
+	) {
+		qoi_encoder_flush(enc);
+	}
+
+	if (!enc->error) {
+		bytes = qoi_enc_flush(&enc->state, enc->buf + enc->buf_len);
+		memcpy(bytes, qoi_padding, sizeof(qoi_padding));
+		enc->buf_len = bytes + sizeof(qoi_padding) - enc->buf;
+		qoi_encoder_flush(enc);
+	}
+
+	QOI_FREE(enc->buf);
+	enc->buf = NULL;
+	return !enc->error;
+}
+
+/* Encode a complete image, header and end marker included, from rows of
+row_len bytes that are stride bytes apart. Returns the end of the output. */
+static unsigned char *qoi_encode_rows(
+	const unsigned char *row, const qoi_desc *desc, size_t stride,
+	size_t row_len, qoi_enc_fn encode, unsigned char *bytes
+) {
+	qoi_enc_state s;
+	unsigned int y;
+
+	bytes = qoi_enc_header(bytes, desc);
+	qoi_enc_init(&s);
+	if (stride == row_len) {
+		bytes = encode(&s, row, row + row_len * desc->height, bytes);
+	}
+	else {
+		for (y = 0; y < desc->height; y++, row += stride) {
+			bytes = encode(&s, row, row + row_len, bytes);
+		}
+	}
+	bytes = qoi_enc_flush(&s, bytes);
+	memcpy(bytes, qoi_padding, sizeof(qoi_padding));
+	return bytes + sizeof(qoi_padding);
+}
+
+void *qoi_encode_ex(
+	const void *data, const qoi_desc *desc, size_t stride, int layout,
+	size_t *out_len, qoi_stats *stats, const qoi_allocator *allocator
+) {
+	unsigned char *bytes, *b;
+	qoi_enc_fn encode;
+	size_t row_len;
+	int bpp;
+#ifdef QOI_STATS
+	unsigned long long time_start;
+#else
+	(void)stats;
+#endif
+
+	if (data == NULL || out_len == NULL || !qoi_valid_desc(desc)) {
+		return NULL;
+	}
+
+	encode = qoi_enc_select(layout, desc->channels, &bpp);
+	row_len = (size_t)desc->width * bpp;
+	if (stride == 0) {
+		stride = row_len;
+	}
+	if (encode == NULL || stride < row_len) {
+		return NULL;
+	}
+
+	bytes = (unsigned char *) qoi_alloc(allocator, qoi_encode_bound(desc));
+	if (!bytes) {
+		return NULL;
+	}
+
+#ifdef QOI_STATS
+	time_start = stats ? qoi_stats_now() : 0;
+#endif
+	b = qoi_encode_rows(
+		(const unsigned char *)data, desc, stride, row_len, encode, bytes
+	);
+
+#ifdef QOI_STATS
+	if (stats) {
+		stats->time_ns = qoi_stats_now() - time_start;
+		qoi_stats_collect(
+			stats, bytes + QOI_HEADER_SIZE, b - sizeof(qoi_padding)
+		);
+	}
+#endif
+
+	*out_len = b - bytes;
+	return bytes;
+}
+
+/* Multi-threaded encoding
+
+The image is split into strips of consecutive pixels and each strip is encoded
+on its own thread. The encoder state at the start of a strip can be derived
+from the pixels before it alone:
+ - px_prev is simply the preceding pixel.
+ - Every pixel that was encoded ends up in index[hash(px)] (either it was
+   already there, or it was put there), except the pixels of a run at the very
+   start of the image, which repeat the initial px_prev that never entered the
+   index. So each slot holds the last preceding pixel with that hash.
+ - A run in progress is handled by the seams: each strip leaves out its leading
+   pixels that repeat px_prev and keeps its trailing run unflushed. These are
+   joined into QOI_OP_RUNs between the strips when the results are stitched
+   together.
+
+Phase 1 finds the last pixel for each index slot in each strip (scanning
+backwards, stopping once all 64 slots are found). Phase 2 combines these into
+the start state of each strip and encodes all strips. Both phases run in
+parallel; the final stitching is a sequential memmove. */
+
+/* Strips smaller than this are not worth a thread */
+#define QOI_MT_MIN_PX (64 * 1024)
+
+typedef struct {
+	const unsigned char *pixels;
+	size_t start, end;
+	int channels;
+
+	/* phase 1 */
+	qoi_rgba_t last[64];
+	size_t last_pos[64];
+	unsigned char found[64];
+	size_t init_lead;
+
+	/* phase 2 */
+	qoi_enc_state state;
+	qoi_enc_fn encode;
+	unsigned char *out;
+	size_t out_len;
+	size_t lead;
+} qoi_mt_strip;
+
+static QOI_INLINE qoi_rgba_t qoi_mt_px(const unsigned char *pixels, size_t i, int channels) {
+	qoi_rgba_t px;
+	if (channels == 4) {
+		memcpy(&px, pixels + i * 4, 4);
+	}
+	else {
+		px.rgba.r = pixels[i * 3 + 0];
+		px.rgba.g = pixels[i * 3 + 1];
+		px.rgba.b = pixels[i * 3 + 2];
+		px.rgba.a = 255;
+	}
+	return px;
+}
+
+static void qoi_mt_scan(void *job) {
+	qoi_mt_strip *st = (qoi_mt_strip *)job;
+	qoi_rgba_t px, px_init;
+	size_t i;
+	int nfound = 0;
+
+	memset(st->found, 0, sizeof(st->found));
+	for (i = st->end; i > st->start && nfound < 64; i--) {
+		int index_pos;
+		px = qoi_mt_px(st->pixels, i - 1, st->channels);
+		index_pos = QOI_COLOR_HASH(px) % 64;
+		if (!st->found[index_pos]) {
+			st->found[index_pos] = 1;
+			st->last[index_pos] = px;
+			st->last_pos[index_pos] = i - 1;
+			nfound++;
+		}
+	}
+
+	px_init.v = 0;
+	px_init.rgba.a = 255;
+	for (i = st->start; i < st->end; i++) {
+		if (qoi_mt_px(st->pixels, i, st->channels).v != px_init.v) {
+			break;
+		}
+	}
+	st->init_lead = i - st->start;
+}
+
+static void qoi_mt_encode(void *job) {
+	qoi_mt_strip *st = (qoi_mt_strip *)job;
+	size_t i;
+
+	for (i = st->start; i < st->end; i++) {
+		if (qoi_mt_px(st->pixels, i, st->channels).v != st->state.px_prev.v) {
+			break;
+		}
+	}
+	st->lead = i - st->start;
+	st->out += st->lead * (st->channels + 1);
+
+	st->out_len = st->encode(
+		&st->state,
+		st->pixels + i * st->channels,
+		st->pixels + st->end * st->channels,
+		st->out
+	) - st->out;
+}
+
+static unsigned char *qoi_mt_runs(unsigned char *bytes, size_t run) {
+	for (; run >= 62; run -= 62) {
+		*bytes++ = QOI_OP_RUN | 61;
+	}
+	if (run > 0) {
+		*bytes++ = QOI_OP_RUN | (run - 1);
+	}
+	return bytes;
+}
+
+void *qoi_encode_mt(
+	const void *data, const qoi_desc *desc, int nthreads, size_t *out_len
+) {
+	unsigned char *bytes, *b, *chunks;
+	const unsigned char *pixels;
+	qoi_mt_strip *strips;
+	size_t px_count, skip, run;
+	int channels, nstrips, k, j, i, bpp;
+
+	if (data == NULL || out_len == NULL || !qoi_valid_desc(desc)) {
+		return NULL;
+	}
+
+	px_count = (size_t)desc->width * desc->height;
+	nstrips = nthreads;
+	if ((size_t)nstrips > px_count / QOI_MT_MIN_PX) {
+		nstrips = (int)(px_count / QOI_MT_MIN_PX);
+	}
+	if (nstrips <= 1) {
+		return qoi_encode64(data, desc, out_len);
+	}
+
+	bytes = (unsigned char *) QOI_MALLOC(qoi_encode_bound(desc));
+	strips = (qoi_mt_strip *) QOI_MALLOC(sizeof(qoi_mt_strip) * nstrips);
+	if (!bytes || !strips) {
+		QOI_FREE(bytes);
+		QOI_FREE(strips);
+		return NULL;
+	}
+
+	pixels = (const unsigned char *)data;
+	channels = desc->channels;
+	chunks = qoi_enc_header(bytes, desc);
+
+	for (k = 0; k < nstrips; k++) {
+		strips[k].pixels = pixels;
+		strips[k].channels = channels;
+		strips[k].start = px_count * k / nstrips;
+		strips[k].end = px_count * (k + 1) / nstrips;
+	}
+	qoi_parallel(qoi_mt_scan, strips, sizeof(qoi_mt_strip), nstrips);
+
+	/* Find the end of the initial run of the starting pixel value; none of these
+	pixels enter the index */
+	skip = px_count;
+	for (k = 0; k < nstrips; k++) {
+		if (strips[k].init_lead < strips[k].end - strips[k].start) {
+			skip = strips[k].start + strips[k].init_lead;
+			break;
+		}
+	}
+
+	for (k = 0; k < nstrips; k++) {
+		qoi_mt_strip *st = &strips[k];
+		qoi_enc_init(&st->state);
+		for (i = 0; i < 64; i++) {
+			for (j = k - 1; j >= 0; j--) {
+				if (strips[j].found[i]) {
+					if (strips[j].last_pos[i] >= skip) {
+						st->state.index[i] = strips[j].last[i];
+					}
+					break;
+				}
+			}
+		}
+		if (k > 0) {
+			st->state.px_prev = qoi_mt_px(pixels, st->start - 1, channels);
+		}
+		st->encode = qoi_enc_select(QOI_LAYOUT_OF(channels), channels, &bpp);
+
+		/* Each pixel takes at most channels + 1 bytes. qoi_mt_encode() puts
+		the output of a strip at the worst case position of its first non-run
+		pixel, so the stitching below never overwrites data that wasn't moved
+		yet. */
+		st->out = chunks + st->start * (channels + 1);
+	}
+	qoi_parallel(qoi_mt_encode, strips, sizeof(qoi_mt_strip), nstrips);
+
+	b = chunks;
+	run = 0;
+	for (k = 0; k < nstrips; k++) {
+		qoi_mt_strip *st = &strips[k];
+		run += st->lead;
+		if (st->start + st->lead < st->end) {
+			b = qoi_mt_runs(b, run);
+			memmove(b, st->out, st->out_len);
+			b += st->out_len;
+			run = st->state.run;
+		}
+	}
+	b = qoi_mt_runs(b, run);
+	memcpy(b, qoi_padding, sizeof(qoi_padding));
+	b += sizeof(qoi_padding);
+
+	QOI_FREE(strips);
+	*out_len = b - bytes;
+	return bytes;
+}
+
+void *qoi_encode64(const void *data, const qoi_desc *desc, size_t *out_len) {
+	size_t max_size;
+	void *bytes;
+
+	if (data == NULL || out_len == NULL || !qoi_valid_desc(desc)) {
+		return NULL;
+	}
+
+	max_size = qoi_encode_bound(desc);
+	bytes = QOI_MALLOC(max_size);
+	if (!bytes) {
+		return NULL;
+	}
+
+	if (!qoi_encode_into(data, desc, bytes, max_size, out_len)) {
+		QOI_FREE(bytes);
+		return NULL;
+	}
+	return bytes;
+}
+
+void *qoi_encode(const void *data, const qoi_desc *desc, int *out_len) {
+	size_t len;
+	void *bytes;
+
+	if (out_len == NULL || !qoi_valid_desc(desc) || !qoi_within_pixels_max(desc)) {
+		return NULL;
+	}
+
+	bytes = qoi_encode64(data, desc, &len);
+	if (bytes) {
+		*out_len = (int)len;
+	}
+	return bytes;
+}
+
+static void qoi_dec_init(qoi_dec_state *s) {
+	QOI_ZEROARR(s->index);
+	s->run = 0;
+	s->px.rgba.r = 0;
+	s->px.rgba.g = 0;
+	s->px.rgba.b = 0;
+	s->px.rgba.a = 255;
+}
+
+/* Store one decoded pixel. 3 channel pixels are written with a 4 byte store
+(except for the very last one), which is later overwritten by the next
+pixel. */
+static QOI_INLINE unsigned char *qoi_dec_put(
+	unsigned char *pixels, unsigned char *pixels_end, qoi_rgba_t px,
+	const int channels
+) {
+	if (channels == 4 || pixels_end - pixels >= 4) {
+		memcpy(pixels, &px, 4);
+	}
+	else {
+		pixels[0] = px.rgba.r;
+		pixels[1] = px.rgba.g;
+		pixels[2] = px.rgba.b;
+	}
+	return pixels + channels;
+}
+
+/* Store n copies of px, for a run. Short runs are stored pixel by pixel. Longer
+runs are stored with 16 byte (32 byte with AVX2) stores for 4 channels, and
+with a 48 byte pattern of 16 pixels for 3 channels. pixels + n * channels must
+not be beyond pixels_end. */
+#define QOI_DEC_FILL_MIN 16
+
+static QOI_INLINE unsigned char *qoi_dec_fill(
+	unsigned char *pixels, unsigned char *pixels_end, size_t n, qoi_rgba_t px,
+	const int channels
+) {
+	unsigned char *end = pixels + n * channels;
+
+	if (n < QOI_DEC_FILL_MIN) {
+		while (pixels < end) {
+			pixels = qoi_dec_put(pixels, pixels_end, px, channels);
+		}
+	}
+	else if (channels == 4) {
+		#ifdef QOI_SSE2
+		{
+			__m128i v4 = _mm_set1_epi32((int)px.v);
+			#ifdef QOI_AVX2
+			{
+				__m256i v8 = _mm256_set1_epi32((int)px.v);
+				while (end - pixels >= 32) {
+					_mm256_storeu_si256((__m256i *)pixels, v8);
+					pixels += 32;
+				}
+			}
+			#endif
+			while (end - pixels >= 16) {
+				_mm_storeu_si128((__m128i *)pixels, v4);
+				pixels += 16;
+			}
+		}
+		#endif
+		while (pixels < end) {
+			memcpy(pixels, &px, 4);
+			pixels += 4;
+		}
+	}
+	else {
+		unsigned char pattern[48 + 1];
+
+		memcpy(pattern + 0, &px, 4);
+		memcpy(pattern + 3, &px, 4);
+		memcpy(pattern + 6, &px, 4);
+		memcpy(pattern + 9, &px, 4);
+		memcpy(pattern + 12, pattern, 12);
+		memcpy(pattern + 24, pattern, 24);
+
+		#ifdef QOI_SSE2
+		{
+			__m128i v0 = _mm_loadu_si128((const __m128i *)(pattern +  0));
+			__m128i v1 = _mm_loadu_si128((const __m128i *)(pattern + 16));
+			__m128i v2 = _mm_loadu_si128((const __m128i *)(pattern + 32));
+			while (end - pixels >= 48) {
+				_mm_storeu_si128((__m128i *)(pixels +  0), v0);
+				_mm_storeu_si128((__m128i *)(pixels + 16), v1);
+				_mm_storeu_si128((__m128i *)(pixels + 32), v2);
+				pixels += 48;
+			}
+		}
+		#endif
+		while (end - pixels >= 48) {
+			memcpy(pixels, pattern, 48);
+			pixels += 48;
+		}
+		memcpy(pixels, pattern, end - pixels);
+	}
+	return end;
+}
+
+/* Decode the chunk at *bytes_p into px and update the index. Returns the
+number of pixels for a QOI_OP_RUN, otherwise 0. */
+static QOI_INLINE int qoi_dec_chunk(
+	qoi_rgba_t *index, qoi_rgba_t *px_p, const unsigned char **bytes_p
+) {
+	const unsigned char *bytes = *bytes_p;
+	qoi_rgba_t px = *px_p;
+	int b1 = *bytes++;
+	int run = 0;
+
+	if (b1 == QOI_OP_RGB) {
+		px.rgba.r = bytes[0];
+		px.rgba.g = bytes[1];
+		px.rgba.b = bytes[2];
+		bytes += 3;
+	}
+	else if (b1 == QOI_OP_RGBA) {
+		px.rgba.r = bytes[0];
+		px.rgba.g = bytes[1];
+		px.rgba.b = bytes[2];
+		px.rgba.a = bytes[3];
+		bytes += 4;
+	}
+	else if ((b1 & QOI_MASK_2) == QOI_OP_INDEX) {
+		px = index[b1];
+	}
+	else if ((b1 & QOI_MASK_2) == QOI_OP_DIFF) {
+		px.rgba.r += ((b1 >> 4) & 0x03) - 2;
+		px.rgba.g += ((b1 >> 2) & 0x03) - 2;
+		px.rgba.b += ( b1       & 0x03) - 2;
+	}
+	else if ((b1 & QOI_MASK_2) == QOI_OP_LUMA) {
+		int b2 = *bytes++;
+		int vg = (b1 & 0x3f) - 32;
+		px.rgba.r += vg - 8 + ((b2 >> 4) & 0x0f);
+		px.rgba.g += vg;
+		px.rgba.b += vg - 8 +  (b2       & 0x0f);
+	}
+	else if ((b1 & QOI_MASK_2) == QOI_OP_RUN) {
+		run = (b1 & 0x3f) + 1;
+	}
+
+	index[QOI_COLOR_HASH(px) % 64] = px;
+	*px_p = px;
+	*bytes_p = bytes;
+	return run;
+}
+
+/* Walk over n pixels without storing them, only keeping the decoder state up
+to date. Returns the number of pixels walked, which is less than n only if the
+chunks ran out. */
+static size_t qoi_dec_walk(
+	qoi_dec_state *s, const unsigned char **bytes_p, const unsigned char *bytes_end,
+	size_t n
+) {
+	const unsigned char *bytes = *bytes_p;
+	qoi_rgba_t px = s->px;
+	size_t left = n;
+	int run = s->run;
+
+	while (left > 0) {
+		if (run > 0) {
+			size_t k = (size_t)run < left ? (size_t)run : left;
+			run -= (int)k;
+			left -= k;
+		}
+		else if (bytes < bytes_end) {
+			run = qoi_dec_chunk(s->index, &px, &bytes);
+			if (run == 0) {
+				left--;
+			}
+		}
+		else {
+			break;
+		}
+	}
+
+	s->px = px;
+	s->run = run;
+	*bytes_p = bytes;
+	return n - left;
+}
+
+/* Decode chunks from *bytes_p into the pixels in [pixels, pixels_end), with the
+given number of output channels. A chunk is only read if it starts before
+bytes_end; the caller must make sure that it can be read completely, i.e. that
+at least 4 more readable bytes follow bytes_end (the qoi_padding does that for
+a complete QOI image). s->run holds the number of pixels of the current run
+that are still to be stored; a run that extends past pixels_end is kept there.
+
+Returns the new write position. This is pixels_end unless the chunks ran out.
+
+This function is always inlined with a constant number of channels; see
+QOI_DEC_SPECIALIZE below. */
+static QOI_INLINE unsigned char *qoi_dec_pixels(
+	qoi_dec_state *s, const unsigned char **bytes_p, const unsigned char *bytes_end,
+	unsigned char *pixels, unsigned char *pixels_end, const int channels
+) {
+	const unsigned char *bytes = *bytes_p;
+	qoi_rgba_t *index = s->index;
+	qoi_rgba_t px = s->px;
+	int run = s->run;
+
+	while (pixels < pixels_end) {
+		if (run > 0) {
+			size_t n = (pixels_end - pixels) / channels;
+			if ((size_t)run < n) {
+				n = run;
+			}
+			pixels = qoi_dec_fill(pixels, pixels_end, n, px, channels);
+			run -= (int)n;
+			continue;
+		}
+		else if (bytes < bytes_end) {
+			run = qoi_dec_chunk(index, &px, &bytes);
+			if (run > 0) {
+				continue;
+			}
+		}
+		else {
+			break;
+		}
+
+		pixels = qoi_dec_put(pixels, pixels_end, px, channels);
+	}
+
+	s->px = px;
+	s->run = run;
+	*bytes_p = bytes;
+	return pixels;
+}
+
+/* Alternative to qoi_dec_pixels that classifies each tag byte with a lookup in
+qoi_dec_table instead of a chain of compares. QOI_OP_DIFF and QOI_OP_LUMA share
+one path: the table holds the deltas (with the bias already subtracted) and a
+mask for the second byte, which is 0 for QOI_OP_DIFF. The remaining ops are
+dispatched with a switch, which compiles to a jump table.
+
+Which variant is faster depends on the CPU and the image content; see the
+qoi-t rows of qoibench. */
+
+#define QOI_DT_INDEX 0
+#define QOI_DT_DELTA 1
+#define QOI_DT_RUN   2
+#define QOI_DT_RGB   3
+#define QOI_DT_RGBA  4
+
+typedef struct {
+	unsigned char op;
+	unsigned char len;  /* bytes following the tag byte */
+	unsigned char mask; /* mask for the nibbles of the 2nd byte of QOI_OP_LUMA */
+	signed char dr, dg, db;
+} qoi_dec_op;
+
+#define QOI_DT(B) { \
+	(B) == QOI_OP_RGB ? QOI_DT_RGB : \
+	(B) == QOI_OP_RGBA ? QOI_DT_RGBA : \
+	((B) & QOI_MASK_2) == QOI_OP_INDEX ? QOI_DT_INDEX : \
+	((B) & QOI_MASK_2) == QOI_OP_RUN ? QOI_DT_RUN : QOI_DT_DELTA, \
+	(B) == QOI_OP_RGB ? 3 : \
+	(B) == QOI_OP_RGBA ? 4 : \
+	((B) & QOI_MASK_2) == QOI_OP_LUMA ? 1 : 0, \
+	((B) & QOI_MASK_2) == QOI_OP_LUMA ? 0x0f : 0, \
+	((B) & QOI_MASK_2) == QOI_OP_DIFF ? (((B) >> 4) & 0x03) - 2 : \
+	((B) & QOI_MASK_2) == QOI_OP_LUMA ? ((B) & 0x3f) - 40 : \
+	((B) & QOI_MASK_2) == QOI_OP_RUN ? ((B) & 0x3f) : 0, \
+	((B) & QOI_MASK_2) == QOI_OP_DIFF ? (((B) >> 2) & 0x03) - 2 : \
+	((B) & QOI_MASK_2) == QOI_OP_LUMA ? ((B) & 0x3f) - 32 : 0, \
+	((B) & QOI_MASK_2) == QOI_OP_DIFF ? ( (B)       & 0x03) - 2 : \
+	((B) & QOI_MASK_2) == QOI_OP_LUMA ? ((B) & 0x3f) - 40 : 0 \
+}
+#define QOI_DT4(B)  QOI_DT(B), QOI_DT((B) + 1), QOI_DT((B) + 2), QOI_DT((B) + 3)
+#define QOI_DT16(B) QOI_DT4(B), QOI_DT4((B) + 4), QOI_DT4((B) + 8), QOI_DT4((B) + 12)
+#define QOI_DT64(B) QOI_DT16(B), QOI_DT16((B) + 16), QOI_DT16((B) + 32), QOI_DT16((B) + 48)
+
+static const qoi_dec_op qoi_dec_table[256] = {
+	QOI_DT64(0x00), QOI_DT64(0x40), QOI_DT64(0x80), QOI_DT64(0xc0)
+};
+
+static QOI_INLINE unsigned char *qoi_dec_pixels_table(
+	qoi_dec_state *s, const unsigned char **bytes_p, const unsigned char *bytes_end,
+	unsigned char *pixels, unsigned char *pixels_end, const int channels
+) {
+	const unsigned char *bytes = *bytes_p;
+	qoi_rgba_t *index = s->index;
+	qoi_rgba_t px = s->px;
+	int run = s->run;
+
+	while (pixels < pixels_end) {
+		if (run > 0) {
+			size_t n = (pixels_end - pixels) / channels;
+			if ((size_t)run < n) {
+				n = run;
+			}
+			pixels = qoi_dec_fill(pixels, pixels_end, n, px, channels);
+			run -= (int)n;
+			continue;
+		}
+		else if (bytes < bytes_end) {
+			int b1 = *bytes++;
+			const qoi_dec_op *op = &qoi_dec_table[b1];
+
+			switch (op->op) {
+				case QOI_DT_INDEX:
+					px = index[b1];
+					break;
+				case QOI_DT_DELTA: {
+					int b2 = bytes[0];
+					px.rgba.r += op->dr + ((b2 >> 4) & op->mask);
+					px.rgba.g += op->dg;
+					px.rgba.b += op->db + (b2 & op->mask);
+					break;
+				}
+				case QOI_DT_RUN:
+					run = op->dr + 1;
+					index[QOI_COLOR_HASH(px) % 64] = px;
+					continue;
+				case QOI_DT_RGBA:
+					px.rgba.a = bytes[3];
+					/* fall through */
+				default:
+					px.rgba.r = bytes[0];
+					px.rgba.g = bytes[1];
+					px.rgba.b = bytes[2];
+					break;
+			}
+			bytes += op->len;
+
+			index[QOI_COLOR_HASH(px) % 64] = px;
+		}
+		else {
+			break;
+		}
+
+		pixels = qoi_dec_put(pixels, pixels_end, px, channels);
+	}
+
+	s->px = px;
+	s->run = run;
+	*bytes_p = bytes;
+	return pixels;
+}
+
+#define QOI_DEC_SPECIALIZE(NAME, KERNEL, CHANNELS) \
+	static unsigned char *NAME( \
+		qoi_dec_state *s, const unsigned char **bytes_p, \
+		const unsigned char *bytes_end, \
+		unsigned char *pixels, unsigned char *pixels_end \
+	) { \
+		return KERNEL(s, bytes_p, bytes_end, pixels, pixels_end, CHANNELS); \
+	}
+
+QOI_DEC_SPECIALIZE(qoi_dec_rgba, qoi_dec_pixels, 4)
+QOI_DEC_SPECIALIZE(qoi_dec_rgb,  qoi_dec_pixels, 3)
+QOI_DEC_SPECIALIZE(qoi_dec_table_rgba, qoi_dec_pixels_table, 4)
+QOI_DEC_SPECIALIZE(qoi_dec_table_rgb,  qoi_dec_pixels_table, 3)
+
+typedef unsigned char *(*qoi_dec_fn)(
+	qoi_dec_state *s, const unsigned char **bytes_p,
+	const unsigned char *bytes_end,
+	unsigned char *pixels, unsigned char *pixels_end
+);
+
+#define QOI_DEC_SELECT(channels) ((channels) == 4 ? qoi_dec_rgba : qoi_dec_rgb)
+#define QOI_DEC_SELECT_TABLE(channels) \
+	((channels) == 4 ? qoi_dec_table_rgba : qoi_dec_table_rgb)
+
+/* Read and validate the header. Returns 0 if size is too short to hold the
+header or the header is invalid. */
+static int qoi_dec_header(const unsigned char *bytes, size_t size, qoi_desc *desc) {
+	unsigned int header_magic;
+	int p = 0;
+
+	if (size < QOI_HEADER_SIZE) {
+		return 0;
+	}
+
+	header_magic = qoi_read_32(bytes, &p);
+	desc->width = qoi_read_32(bytes, &p);
+	desc->height = qoi_read_32(bytes, &p);
+	desc->channels = bytes[p++];
+	desc->colorspace = bytes[p++];
+
+	return header_magic == QOI_MAGIC && qoi_valid_desc(desc);
+}
+
+static int qoi_decode_into_impl(
+	const void *data, size_t size, qoi_desc *desc, int channels,
+	void *out, size_t out_stride, int flags, int pixels_max, qoi_stats *stats
+) {
+	const unsigned char *bytes, *chunks, *chunks_end;
+	unsigned char *row, *px_pos;
+	size_t row_len;
+	unsigned int y;
+	qoi_dec_state s;
+	qoi_dec_fn decode;
+#ifdef QOI_STATS
+	unsigned long long time_start = stats ? qoi_stats_now() : 0;
+#else
+	(void)stats;
+#endif
+
+	if (
+		data == NULL || desc == NULL || out == NULL ||
+		(channels != 0 && channels != 3 && channels != 4)
+	) {
+		return 0;
+	}
+
+	bytes = (const unsigned char *)data;
+	if (
+		size < QOI_HEADER_SIZE + sizeof(qoi_padding) ||
+		!qoi_dec_header(bytes, size, desc) ||
+		(pixels_max && !qoi_within_pixels_max(desc))
+	) {
+		return 0;
+	}
+
+	if (channels == 0) {
+		channels = desc->channels;
+	}
+
+	row_len = (size_t)desc->width * channels;
+	if (out_stride == 0) {
+		out_stride = row_len;
+	}
+	if (out_stride < row_len) {
+		return 0;
+	}
+
+	decode = (flags & QOI_DISPATCH_TABLE)
+		? QOI_DEC_SELECT_TABLE(channels)
+		: QOI_DEC_SELECT(channels);
+	qoi_dec_init(&s);
+	chunks_end = bytes + size - sizeof(qoi_padding);
+	bytes += QOI_HEADER_SIZE;
+	chunks = bytes;
+
+	if (out_stride == row_len && !(flags & QOI_FLIP_Y)) {
+		/* Contiguous rows; decode all pixels in one go */
+		unsigned char *pixels_end = (unsigned char *)out + row_len * desc->height;
+		px_pos = decode(&s, &bytes, chunks_end, (unsigned char *)out, pixels_end);
+
+		/* Truncated data; repeat the last pixel */
+		for (; px_pos < pixels_end; px_pos += channels) {
+			memcpy(px_pos, &s.px, channels);
+		}
+	}
+	else {
+		for (y = 0; y < desc->height; y++) {
+			row = (unsigned char *)out + out_stride *
+				((flags & QOI_FLIP_Y) ? desc->height - 1 - y : y);
+			px_pos = decode(&s, &bytes, chunks_end, row, row + row_len);
+			for (; px_pos < row + row_len; px_pos += channels) {
+				memcpy(px_pos, &s.px, channels);
+			}
+		}
+	}
+
+#ifdef QOI_STATS
+	if (stats) {
+		stats->time_ns = qoi_stats_now() - time_start;
+		qoi_stats_collect(stats, chunks, bytes);
+	}
+#else
+	(void)chunks;
+#endif
+
+	return 1;
+}
+
+static void *qoi_decode_impl(
+	const void *data, size_t size, qoi_desc *desc, int channels, int pixels_max,
+	qoi_stats *stats, const qoi_allocator *allocator
+) {
+	unsigned char *pixels;
+
+	if (
+		data == NULL || desc == NULL ||
+		(channels != 0 && channels != 3 && channels != 4) ||
+		size < QOI_HEADER_SIZE + sizeof(qoi_padding) ||
+		!qoi_dec_header((const unsigned char *)data, size, desc) ||
+		(pixels_max && !qoi_within_pixels_max(desc))
+	) {
+		return NULL;
+	}
+
+	if (channels == 0) {
+		channels = desc->channels;
+	}
+
+	pixels = (unsigned char *) qoi_alloc(
+		allocator, (size_t)desc->width * desc->height * channels
+	);
+	if (!pixels) {
+		return NULL;
+	}
+
+	if (!qoi_decode_into_impl(data, size, desc, channels, pixels, 0, 0, pixels_max, stats)) {
+		qoi_free(allocator, pixels);
+		return NULL;
+	}
+	return pixels;
+}
+
+void *qoi_decode64(const void *data, size_t size, qoi_desc *desc, int channels) {
+	return qoi_decode_impl(data, size, desc, channels, 0, NULL, NULL);
+}
+
+void *qoi_decode_ex(
+	const void *data, size_t size, qoi_desc *desc, int channels,
+	qoi_stats *stats, const qoi_allocator *allocator
+) {
+	return qoi_decode_impl(data, size, desc, channels, 0, stats, allocator);
+}
+
+int qoi_decode_into(
+	const void *data, size_t size, qoi_desc *desc, int channels,
+	void *out, size_t out_stride, int flags
+) {
+	return qoi_decode_into_impl(
+		data, size, desc, channels, out, out_stride, flags, 0, NULL
+	);
+}
+
+void *qoi_decode_scaled(
+	const void *data, size_t size, qoi_desc *desc, int channels, int scale
+) {
+	const unsigned char *bytes = (const unsigned char *)data;
+	const unsigned char *chunks_end;
+	unsigned char *pixels, *row, *px_pos, *out;
+	unsigned int *acc;
+	unsigned int out_w, out_h, x, y, rows;
+	qoi_dec_state s;
+	int shift, c;
+
+	if (scale == 1) {
+		return qoi_decode64(data, size, desc, channels);
+	}
+	shift = scale == 2 ? 1 : scale == 4 ? 2 : scale == 8 ? 3 : 0;
+	if (
+		data == NULL || desc == NULL || shift == 0 ||
+		(channels != 0 && channels != 3 && channels != 4) ||
+		size < QOI_HEADER_SIZE + sizeof(qoi_padding) ||
+		!qoi_dec_header(bytes, size, desc)
+	) {
+		return NULL;
+	}
+
+	if (channels == 0) {
+		channels = desc->channels;
+	}
+	/* Round up without overflowing for sizes close to UINT_MAX. The allocations
+	below are no larger than the full image, which qoi_dec_header has checked. */
+	out_w = (desc->width >> shift) + ((desc->width & (scale - 1)) != 0);
+	out_h = (desc->height >> shift) + ((desc->height & (scale - 1)) != 0);
+
+	pixels = (unsigned char *) QOI_MALLOC((size_t)out_w * out_h * channels);
+	row = (unsigned char *) QOI_MALLOC((size_t)desc->width * 4);
+	acc = (unsigned int *) QOI_MALLOC((size_t)out_w * 4 * sizeof(unsigned int));
+	if (!pixels || !row || !acc) {
+		QOI_FREE(pixels);
+		QOI_FREE(row);
+		QOI_FREE(acc);
+		return NULL;
+	}
+
+	qoi_dec_init(&s);
+	chunks_end = bytes + size - sizeof(qoi_padding);
+	bytes += QOI_HEADER_SIZE;
+	out = pixels;
+	memset(acc, 0, (size_t)out_w * 4 * sizeof(unsigned int));
+
+	for (y = 0, rows = 0; y < desc->height; y++) {
+		unsigned char *row_end = row + (size_t)desc->width * 4;
+		px_pos = qoi_dec_rgba(&s, &bytes, chunks_end, row, row_end);
+
+		/* Truncated data; repeat the last pixel */
+		for (; px_pos < row_end; px_pos += 4) {
+			memcpy(px_pos, &s.px, 4);
+		}
+
+		for (x = 0; x < desc->width; x++) {
+			unsigned int *a = acc + (size_t)(x >> shift) * 4;
+			unsigned char *p = row + (size_t)x * 4;
+			a[0] += p[0];
+			a[1] += p[1];
+			a[2] += p[2];
+			a[3] += p[3];
+		}
+
+		/* Emit a row of averages at the end of each block of rows */
+		if (++rows == (unsigned int)scale || y == desc->height - 1) {
+			for (x = 0; x < out_w; x++) {
+				unsigned int cols = desc->width - (x << shift);
+				unsigned int n = (cols < (unsigned int)scale ? cols : (unsigned int)scale) * rows;
+				for (c = 0; c < channels; c++) {
+					*out++ = (unsigned char)((acc[(size_t)x * 4 + c] + n / 2) / n);
+				}
+			}
+			memset(acc, 0, (size_t)out_w * 4 * sizeof(unsigned int));
+			rows = 0;
+		}
+	}
+
+	QOI_FREE(row);
+	QOI_FREE(acc);
+	return pixels;
+}
+
+/* Tiled images
+
+A tiled image starts with a container header, followed by a directory of
+tile offsets and the tiles:
+
+struct qoi_tiled_header_t {
+	char     magic[4];   // magic bytes "qoit"
+	uint32_t width;      // image width in pixels (BE)
+	uint32_t height;     // image height in pixels (BE)
+	uint32_t tile_size;  // width and height of a tile in pixels (BE)
+	uint8_t  channels;   // 3 = RGB, 4 = RGBA
+	uint8_t  colorspace; // 0 = sRGB with linear alpha, 1 = all channels linear
+};
+uint64_t offsets[ntiles + 1]; // (BE)
+
+The tiles are stored in row-major order; tile t occupies the bytes from
+offsets[t] up to offsets[t + 1], counted from the start of the container. Each
+tile is a complete QOI image with the width and height of its tile, starting
+with a fresh index and previous pixel. */
+
+#define QOI_TILED_MAGIC \
+	(((unsigned int)'q') << 24 | ((unsigned int)'o') << 16 | \
+	 ((unsigned int)'i') <<  8 | ((unsigned int)'t'))
+#define QOI_TILED_HEADER_SIZE 18
+#define QOI_TILED_DEFAULT_SIZE 256
+
+typedef struct {
+	const unsigned char *src;  /* pixels (encode) or container (decode) */
+	size_t size;
+	unsigned char *dst;        /* container (encode) or pixels (decode) */
+	const qoi_desc *desc;
+	unsigned int tile_size;
+	int channels;
+	size_t t0, t1;
+	size_t *pos, *len;         /* encode only */
+	int ok;                    /* decode only */
+} qoi_tiled_job;
+
+/* Find the position and size of tile t */
+static void qoi_tiled_rect(
+	const qoi_desc *desc, unsigned int tile_size, size_t t,
+	unsigned int *x, unsigned int *y, unsigned int *w, unsigned int *h
+) {
+	unsigned int tiles_x = (desc->width - 1) / tile_size + 1;
+	*x = (unsigned int)(t % tiles_x) * tile_size;
+	*y = (unsigned int)(t / tiles_x) * tile_size;
+	*w = desc->width - *x < tile_size ? desc->width - *x : tile_size;
+	*h = desc->height - *y < tile_size ? desc->height - *y : tile_size;
+}
+
+static size_t qoi_tiled_count(const qoi_desc *desc, unsigned int tile_size) {
+	return
+		(size_t)((desc->width - 1) / tile_size + 1) *
+		((desc->height - 1) / tile_size + 1);
+}
+
+/* Read the container header. Returns the number of tiles, or 0 if the header
+or the directory is invalid. */
+static size_t qoi_tiled_header(
+	const unsigned char *bytes, size_t size, qoi_desc *desc,
+	unsigned int *tile_size
+) {
+	size_t ntiles;
+	int p = 0;
+
+	if (bytes == NULL || desc == NULL || size < QOI_TILED_HEADER_SIZE) {
+		return 0;
+	}
+	if (qoi_read_32(bytes, &p) != QOI_TILED_MAGIC) {
+		return 0;
+	}
+	desc->width = qoi_read_32(bytes, &p);
+	desc->height = qoi_read_32(bytes, &p);
+	*tile_size = qoi_read_32(bytes, &p);
+	desc->channels = bytes[p++];
 	desc->colorspace = bytes[p++];
+	if (!qoi_valid_desc(desc) || *tile_size == 0) {
+		return 0;
+	}
+
+	ntiles = qoi_tiled_count(desc, *tile_size);
+	if (ntiles + 1 > (size - QOI_TILED_HEADER_SIZE) / 8) {
+		return 0;
+	}
+	return ntiles;
+}
+
+/* Find the encoded bytes of tile t and check that they hold a QOI image of
+the right size. Returns 0 if the directory or the tile header is invalid. */
+static int qoi_tiled_find(
+	const unsigned char *bytes, size_t size, const qoi_desc *desc,
+	unsigned int tile_size, size_t ntiles, size_t t,
+	const unsigned char **tile, size_t *tile_len
+) {
+	const unsigned char *entry = bytes + QOI_TILED_HEADER_SIZE + t * 8;
+	size_t offset[2];
+	unsigned int x, y, w, h, hi, lo;
+	qoi_desc tile_desc;
+	int p = 0, i;
+
+	for (i = 0; i < 2; i++) {
+		hi = qoi_read_32(entry, &p);
+		lo = qoi_read_32(entry, &p);
+		if (sizeof(size_t) < 8 && hi != 0) {
+			return 0;
+		}
+		offset[i] = (size_t)hi << 31 << 1 | lo;
+	}
+	if (
+		offset[0] < QOI_TILED_HEADER_SIZE + (ntiles + 1) * 8 ||
+		offset[0] > offset[1] || offset[1] > size ||
+		offset[1] - offset[0] < QOI_HEADER_SIZE + sizeof(qoi_padding)
+	) {
+		return 0;
+	}
+	*tile = bytes + offset[0];
+	*tile_len = offset[1] - offset[0];
+
+	qoi_tiled_rect(desc, tile_size, t, &x, &y, &w, &h);
+	return
+		qoi_dec_header(*tile, *tile_len, &tile_desc) &&
+		tile_desc.width == w && tile_desc.height == h;
+}
+
+static void qoi_tiled_encode_job(void *arg) {
+	qoi_tiled_job *job = (qoi_tiled_job *)arg;
+	size_t stride = (size_t)job->desc->width * job->desc->channels;
+	unsigned int x, y, w, h;
+	qoi_enc_fn encode;
+	qoi_desc tile_desc;
+	size_t t;
+	int bpp;
+
+	encode = qoi_enc_select(
+		QOI_LAYOUT_OF(job->desc->channels), job->desc->channels, &bpp
+	);
+	tile_desc = *job->desc;
+	for (t = job->t0; t < job->t1; t++) {
+		unsigned char *start = job->dst + job->pos[t];
+		qoi_tiled_rect(job->desc, job->tile_size, t, &x, &y, &w, &h);
+		tile_desc.width = w;
+		tile_desc.height = h;
+		job->len[t] = qoi_encode_rows(
+			job->src + y * stride + (size_t)x * bpp, &tile_desc, stride,
+			(size_t)w * bpp, encode, start
+		) - start;
+	}
+}
+
+static void qoi_tiled_decode_job(void *arg) {
+	qoi_tiled_job *job = (qoi_tiled_job *)arg;
+	size_t stride = (size_t)job->desc->width * job->channels;
+	size_t ntiles = qoi_tiled_count(job->desc, job->tile_size);
+	const unsigned char *tile;
+	unsigned int x, y, w, h;
+	qoi_desc tile_desc;
+	size_t t, tile_len;
+
+	job->ok = 1;
+	for (t = job->t0; t < job->t1 && job->ok; t++) {
+		qoi_tiled_rect(job->desc, job->tile_size, t, &x, &y, &w, &h);
+		job->ok =
+			qoi_tiled_find(
+				job->src, job->size, job->desc, job->tile_size, ntiles, t,
+				&tile, &tile_len
+			) &&
+			qoi_decode_into(
+				tile, tile_len, &tile_desc, job->channels,
+				job->dst + y * stride + (size_t)x * job->channels, stride, 0
+			);
+	}
+}
+
+/* Split the tiles into njobs ranges and run fn on each */
+static int qoi_tiled_run(
+	qoi_job_fn fn, qoi_tiled_job *proto, size_t ntiles, int nthreads
+) {
+	qoi_tiled_job *jobs;
+	int k, ok = 1;
+
+	if (nthreads > 1 && (size_t)nthreads > ntiles) {
+		nthreads = (int)ntiles;
+	}
+	if (nthreads < 1) {
+		nthreads = 1;
+	}
+
+	jobs = (qoi_tiled_job *) QOI_MALLOC(sizeof(qoi_tiled_job) * nthreads);
+	if (!jobs) {
+		return 0;
+	}
+	for (k = 0; k < nthreads; k++) {
+		jobs[k] = *proto;
+		jobs[k].t0 = ntiles * k / nthreads;
+		jobs[k].t1 = ntiles * (k + 1) / nthreads;
+	}
+	qoi_parallel(fn, jobs, sizeof(qoi_tiled_job), nthreads);
+	for (k = 0; k < nthreads; k++) {
+		ok &= jobs[k].ok;
+	}
+	QOI_FREE(jobs);
+	return ok;
+}
+
+void *qoi_encode_tiled(
+	const void *data, const qoi_desc *desc, unsigned int tile_size,
+	int nthreads, size_t *out_len
+) {
+	unsigned char *bytes;
+	size_t ntiles, t, base, max_size, pos;
+	size_t *tile_pos;
+	qoi_tiled_job job;
+	int p = 0;
+
+	if (data == NULL || out_len == NULL || !qoi_valid_desc(desc)) {
+		return NULL;
+	}
+	if (tile_size == 0) {
+		tile_size = QOI_TILED_DEFAULT_SIZE;
+	}
+
+	/* The worst case: all tiles at their worst case size, each with its own
+	header and end marker, plus the directory */
+	ntiles = qoi_tiled_count(desc, tile_size);
+	base = (size_t)desc->width * desc->height * (desc->channels + 1);
+	if (
+		ntiles > (QOI_SIZE_MAX - base - QOI_TILED_HEADER_SIZE - 8) /
+			(QOI_HEADER_SIZE + sizeof(qoi_padding) + 8)
+	) {
+		return NULL;
+	}
+	max_size = base + QOI_TILED_HEADER_SIZE + 8 +
+		ntiles * (QOI_HEADER_SIZE + sizeof(qoi_padding) + 8);
+
+	bytes = (unsigned char *) QOI_MALLOC(max_size);
+	tile_pos = (size_t *) QOI_MALLOC(sizeof(size_t) * ntiles * 2);
+	if (!bytes || !tile_pos) {
+		QOI_FREE(bytes);
+		QOI_FREE(tile_pos);
+		return NULL;
+	}
+
+	/* Every tile gets a slot of its worst case size to be encoded into */
+	pos = QOI_TILED_HEADER_SIZE + (ntiles + 1) * 8;
+	for (t = 0; t < ntiles; t++) {
+		unsigned int x, y, w, h;
+		qoi_tiled_rect(desc, tile_size, t, &x, &y, &w, &h);
+		tile_pos[t] = pos;
+		pos += (size_t)w * h * (desc->channels + 1) +
+			QOI_HEADER_SIZE + sizeof(qoi_padding);
+	}
+
+	memset(&job, 0, sizeof(job));
+	job.src = (const unsigned char *)data;
+	job.dst = bytes;
+	job.desc = desc;
+	job.tile_size = tile_size;
+	job.pos = tile_pos;
+	job.len = tile_pos + ntiles;
+	job.ok = 1;
+	if (!qoi_tiled_run(qoi_tiled_encode_job, &job, ntiles, nthreads)) {
+		QOI_FREE(bytes);
+		QOI_FREE(tile_pos);
+		return NULL;
+	}
+
+	qoi_write_32(bytes, &p, QOI_TILED_MAGIC);
+	qoi_write_32(bytes, &p, desc->width);
+	qoi_write_32(bytes, &p, desc->height);
+	qoi_write_32(bytes, &p, tile_size);
+	bytes[p++] = desc->channels;
+	bytes[p++] = desc->colorspace;
+
+	/* Move the tiles together and fill in the directory */
+	pos = QOI_TILED_HEADER_SIZE + (ntiles + 1) * 8;
+	for (t = 0; t <= ntiles; t++) {
+		qoi_write_32(bytes, &p, (unsigned int)(pos >> 31 >> 1));
+		qoi_write_32(bytes, &p, (unsigned int)(pos & 0xffffffff));
+		if (t < ntiles) {
+			memmove(bytes + pos, bytes + tile_pos[t], job.len[t]);
+			pos += job.len[t];
+		}
+	}
+
+	QOI_FREE(tile_pos);
+	*out_len = pos;
+	return bytes;
+}
+
+int qoi_tiled_probe(
+	const void *data, size_t size, qoi_desc *desc, unsigned int *tile_size
+) {
+	if (tile_size == NULL) {
+		return 0;
+	}
+	return qoi_tiled_header((const unsigned char *)data, size, desc, tile_size) != 0;
+}
+
+void *qoi_decode_tiled(
+	const void *data, size_t size, qoi_desc *desc, int channels, int nthreads
+) {
+	unsigned char *pixels;
+	unsigned int tile_size;
+	qoi_tiled_job job;
+	size_t ntiles;
+
+	if (channels != 0 && channels != 3 && channels != 4) {
+		return NULL;
+	}
+	ntiles = qoi_tiled_header((const unsigned char *)data, size, desc, &tile_size);
+	if (ntiles == 0) {
+		return NULL;
+	}
+	if (channels == 0) {
+		channels = desc->channels;
+	}
+
+	pixels = (unsigned char *) QOI_MALLOC(
+		(size_t)desc->width * desc->height * channels
+	);
+	if (!pixels) {
+		return NULL;
+	}
+
+	memset(&job, 0, sizeof(job));
+	job.src = (const unsigned char *)data;
+	job.size = size;
+	job.dst = pixels;
+	job.desc = desc;
+	job.tile_size = tile_size;
+	job.channels = channels;
+	if (!qoi_tiled_run(qoi_tiled_decode_job, &job, ntiles, nthreads)) {
+		QOI_FREE(pixels);
+		return NULL;
+	}
+	return pixels;
+}
+
+void *qoi_decode_tile(
+	const void *data, size_t size, qoi_desc *desc, int channels,
+	unsigned int tx, unsigned int ty
+) {
+	const unsigned char *bytes = (const unsigned char *)data;
+	const unsigned char *tile;
+	unsigned int tile_size;
+	size_t ntiles, tile_len;
+	qoi_desc image;
+
+	ntiles = qoi_tiled_header(bytes, size, &image, &tile_size);
+	if (
+		ntiles == 0 || desc == NULL ||
+		tx > (image.width - 1) / tile_size ||
+		ty > (image.height - 1) / tile_size
+	) {
+		return NULL;
+	}
+
+	if (!qoi_tiled_find(
+		bytes, size, &image, tile_size, ntiles,
+		(size_t)ty * ((image.width - 1) / tile_size + 1) + tx,
+		&tile, &tile_len
+	)) {
+		return NULL;
+	}
+	return qoi_decode64(tile, tile_len, desc, channels);
+}
+
+/* Image sequences
+
+A sequence starts with a header, followed by the frames and a directory:
+
+struct qoi_seq_header_t {
+	char     magic[4];   // magic bytes "qois"
+	uint32_t width;      // frame width in pixels (BE)
+	uint32_t height;     // frame height in pixels (BE)
+	uint8_t  channels;   // 3 = RGB, 4 = RGBA
+	uint8_t  colorspace; // 0 = sRGB with linear alpha, 1 = all channels linear
+};
+frames[]
+uint64_t offsets[count]; // (BE) offset of each frame
+uint32_t count;          // number of frames (BE)
+char     magic[4];       // "qosd"
+
+Each frame starts with a type byte. A keyframe (QOI_SEQ_KEY) is followed by a
+complete QOI image of the frame size. A delta frame (QOI_SEQ_DELTA) is
+followed by pairs of
+	varint skip;   // pixels that are the same as in the previous frame
+	varint count;  // pixels that are encoded next, with QOI ops
+until all pixels of the frame are covered, and the 8 byte end marker. The ops
+in a delta frame start with a fresh index and previous pixel, which carry over
+from one span of ops to the next; runs never cross spans. Varints store 7 bits
+per byte, least significant first, with the high bit set on all but the last
+byte. */
+
+#define QOI_SEQ_MAGIC \
+	(((unsigned int)'q') << 24 | ((unsigned int)'o') << 16 | \
+	 ((unsigned int)'i') <<  8 | ((unsigned int)'s'))
+#define QOI_SEQ_DIR_MAGIC \
+	(((unsigned int)'q') << 24 | ((unsigned int)'o') << 16 | \
+	 ((unsigned int)'s') <<  8 | ((unsigned int)'d'))
+#define QOI_SEQ_HEADER_SIZE 14
+#define QOI_SEQ_FOOTER_SIZE 8
+#define QOI_SEQ_KEY   0
+#define QOI_SEQ_DELTA 1
+#define QOI_SEQ_DEFAULT_INTERVAL 60
+
+/* A span of unchanged pixels shorter than this is cheaper to encode with the
+surrounding changed pixels than to skip */
+#define QOI_SEQ_MIN_SKIP 8
+
+/* Return the number of leading bytes that are the same in a and b, comparing
+at most n bytes */
+static size_t qoi_seq_match(
+	const unsigned char *a, const unsigned char *b, size_t n
+) {
+	size_t i = 0;
+#ifdef QOI_SSE2
+	unsigned int m;
+#endif
+
+#ifdef QOI_SSE2
+	#ifdef QOI_AVX2
+	for (; n - i >= 32; i += 32) {
+		m = ~(unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(
+			_mm256_loadu_si256((const __m256i *)(a + i)),
+			_mm256_loadu_si256((const __m256i *)(b + i))
+		));
+		if (m) {
+			return i + qoi_ctz(m);
+		}
+	}
+	#endif
+	for (; n - i >= 16; i += 16) {
+		m = ~_mm_movemask_epi8(_mm_cmpeq_epi8(
+			_mm_loadu_si128((const __m128i *)(a + i)),
+			_mm_loadu_si128((const __m128i *)(b + i))
+		)) & 0xffff;
+		if (m) {
+			return i + qoi_ctz(m);
+		}
+	}
+#else
+	for (; n - i >= 8; i += 8) {
+		unsigned long long va, vb;
+		memcpy(&va, a + i, 8);
+		memcpy(&vb, b + i, 8);
+		if (va != vb) {
+			break;
+		}
+	}
+#endif
+	while (i < n && a[i] == b[i]) {
+		i++;
+	}
+	return i;
+}
+
+static unsigned char *qoi_seq_put_varint(unsigned char *bytes, size_t v) {
+	while (v >= 0x80) {
+		*bytes++ = (unsigned char)(v | 0x80);
+		v >>= 7;
+	}
+	*bytes++ = (unsigned char)v;
+	return bytes;
+}
+
+static int qoi_seq_get_varint(
+	const unsigned char **bytes_p, const unsigned char *bytes_end, size_t *v
+) {
+	const unsigned char *bytes = *bytes_p;
+	size_t shift = 0;
+
+	*v = 0;
+	for (;;) {
+		if (bytes >= bytes_end || shift >= sizeof(size_t) * 8) {
+			return 0;
+		}
+		*v |= (size_t)(*bytes & 0x7f) << shift;
+		if (!(*bytes++ & 0x80)) {
+			break;
+		}
+		shift += 7;
+	}
+	*bytes_p = bytes;
+	return 1;
+}
+
+int qoi_seq_encoder_init(
+	qoi_seq_encoder *enc, const qoi_desc *desc, unsigned int keyframe_interval,
+	qoi_write_fn write, void *user
+) {
+	unsigned char *b;
+	int p = 0;
+
+	if (!qoi_encoder_setup(&enc->enc, desc, write, user)) {
+		return 0;
+	}
+
+	enc->prev = (unsigned char *) QOI_MALLOC(
+		(size_t)desc->width * desc->height * desc->channels
+	);
+	if (!enc->prev) {
+		QOI_FREE(enc->enc.buf);
+		enc->enc.buf = NULL;
+		return 0;
+	}
+	enc->offsets = NULL;
+	enc->frames = 0;
+	enc->frames_cap = 0;
+	enc->keyframe_interval = keyframe_interval ? keyframe_interval : QOI_SEQ_DEFAULT_INTERVAL;
+
+	b = enc->enc.buf;
+	qoi_write_32(b, &p, QOI_SEQ_MAGIC);
+	qoi_write_32(b, &p, desc->width);
+	qoi_write_32(b, &p, desc->height);
+	b[p++] = desc->channels;
+	b[p++] = desc->colorspace;
+	enc->enc.buf_len = p;
+	return 1;
+}
+
+/* Encode the pixels of the current frame from pixels to pixels_end as a span
+of QOI ops, ending with any pending run */
+static int qoi_seq_encode_span(
+	qoi_seq_encoder *enc, const unsigned char *pixels,
+	const unsigned char *pixels_end
+) {
+	unsigned char *b;
+
+	if (!qoi_encoder_push(&enc->enc, pixels, pixels_end)) {
+		return 0;
+	}
+	b = qoi_encoder_reserve(&enc->enc, 1);
+	if (!b) {
+		return 0;
+	}
+	enc->enc.buf_len = qoi_enc_flush(&enc->enc.state, b) - enc->enc.buf;
+	return 1;
+}
+
+int qoi_seq_encoder_push(qoi_seq_encoder *enc, const void *frame) {
+	const unsigned char *px = (const unsigned char *)frame;
+	const unsigned char *prev = enc->prev;
+	int channels = enc->enc.desc.channels;
+	size_t npx = (size_t)enc->enc.desc.width * enc->enc.desc.height;
+	size_t pos, end, same;
+	unsigned char *b;
+	int key;
+
+	if (enc->enc.error || frame == NULL || enc->frames == 0xffffffff) {
+		enc->enc.error = 1;
+		return 0;
+	}
+
+	/* Record the offset of the frame */
+	if (enc->frames == enc->frames_cap) {
+		unsigned int cap = enc->frames_cap ? enc->frames_cap * 2 : 64;
+		size_t *offsets;
+		if (cap < enc->frames_cap) {
+			cap = 0xffffffff;
+		}
+		offsets = (size_t *) QOI_MALLOC(sizeof(size_t) * cap);
+		if (!offsets) {
+			enc->enc.error = 1;
+			return 0;
+		}
+		if (enc->offsets) {
+			memcpy(offsets, enc->offsets, sizeof(size_t) * enc->frames);
+			QOI_FREE(enc->offsets);
+		}
+		enc->offsets = offsets;
+		enc->frames_cap = cap;
+	}
+	enc->offsets[enc->frames] = enc->enc.size + enc->enc.buf_len;
+	key = enc->frames % enc->keyframe_interval == 0;
+	enc->frames++;
+
+	b = qoi_encoder_reserve(&enc->enc, 1 + QOI_HEADER_SIZE);
+	if (!b) {
+		return 0;
+	}
+	*b++ = key ? QOI_SEQ_KEY : QOI_SEQ_DELTA;
+	if (key) {
+		b = qoi_enc_header(b, &enc->enc.desc);
+	}
+	enc->enc.buf_len = b - enc->enc.buf;
+	qoi_enc_init(&enc->enc.state);
+
+	if (key) {
+		if (!qoi_seq_encode_span(enc, px, px + npx * channels)) {
+			return 0;
+		}
+		memcpy(enc->prev, px, npx * channels);
+	}
+	else {
+		for (pos = 0; pos < npx; pos = end) {
+			/* Skip the unchanged pixels, then find the end of the changed
+			ones: the next span of at least QOI_SEQ_MIN_SKIP unchanged pixels,
+			or the end of the frame */
+			size_t skip = qoi_seq_match(
+				px + pos * channels, prev + pos * channels, (npx - pos) * channels
+			) / channels;
+			for (end = pos + skip; end < npx; end += same ? same : 1) {
+				size_t n = npx - end < QOI_SEQ_MIN_SKIP ? npx - end : QOI_SEQ_MIN_SKIP;
+				same = qoi_seq_match(
+					px + end * channels, prev + end * channels, n * channels
+				) / channels;
+				if (same == n) {
+					break;
+				}
+			}
+
+			b = qoi_encoder_reserve(&enc->enc, 2 * 10);
+			if (!b) {
+				return 0;
+			}
+			b = qoi_seq_put_varint(b, skip);
+			b = qoi_seq_put_varint(b, end - pos - skip);
+			enc->enc.buf_len = b - enc->enc.buf;
+			if (!qoi_seq_encode_span(
+				enc, px + (pos + skip) * channels, px + end * channels
+			)) {
+				return 0;
+			}
+
+			/* Only the changed pixels need to be copied to the previous
+			frame */
+			memcpy(
+				enc->prev + (pos + skip) * channels, px + (pos + skip) * channels,
+				(end - pos - skip) * channels
+			);
+		}
+	}
+
+	b = qoi_encoder_reserve(&enc->enc, sizeof(qoi_padding));
+	if (!b) {
+		return 0;
+	}
+	memcpy(b, qoi_padding, sizeof(qoi_padding));
+	enc->enc.buf_len += sizeof(qoi_padding);
+	return 1;
+}
+
+int qoi_seq_encoder_finish(qoi_seq_encoder *enc) {
+	unsigned char *b;
+	unsigned int k;
+	int p;
+
+	for (k = 0; k <= enc->frames && !enc->enc.error; k++) {
+		b = qoi_encoder_reserve(&enc->enc, 8);
+		if (!b) {
+			break;
+		}
+		p = 0;
+		if (k < enc->frames) {
+			qoi_write_32(b, &p, (unsigned int)(enc->offsets[k] >> 31 >> 1));
+			qoi_write_32(b, &p, (unsigned int)(enc->offsets[k] & 0xffffffff));
+		}
+		else {
+			qoi_write_32(b, &p, enc->frames);
+			qoi_write_32(b, &p, QOI_SEQ_DIR_MAGIC);
+		}
+		enc->enc.buf_len += p;
+	}
+	qoi_encoder_flush(&enc->enc);
+
+	QOI_FREE(enc->enc.buf);
+	QOI_FREE(enc->prev);
+	QOI_FREE(enc->offsets);
+	enc->enc.buf = NULL;
+	enc->prev = NULL;
+	enc->offsets = NULL;
+	return !enc->enc.error;
+}
+
+int qoi_seq_decoder_open(
+	qoi_seq_decoder *dec, const void *data, size_t size, int channels
+) {
+	const unsigned char *bytes = (const unsigned char *)data;
+	unsigned int frames;
+	int p = 0;
+
+	if (
+		dec == NULL || data == NULL ||
+		(channels != 0 && channels != 3 && channels != 4) ||
+		size < QOI_SEQ_HEADER_SIZE + QOI_SEQ_FOOTER_SIZE ||
+		qoi_read_32(bytes, &p) != QOI_SEQ_MAGIC
+	) {
+		return 0;
+	}
+	dec->desc.width = qoi_read_32(bytes, &p);
+	dec->desc.height = qoi_read_32(bytes, &p);
+	dec->desc.channels = bytes[p++];
+	dec->desc.colorspace = bytes[p++];
+
+	p = 0;
+	bytes += size - QOI_SEQ_FOOTER_SIZE;
+	frames = qoi_read_32(bytes, &p);
+	if (
+		!qoi_valid_desc(&dec->desc) ||
+		qoi_read_32(bytes, &p) != QOI_SEQ_DIR_MAGIC ||
+		frames > (size - QOI_SEQ_HEADER_SIZE - QOI_SEQ_FOOTER_SIZE) / 8
+	) {
+		return 0;
+	}
+
+	dec->channels = channels ? channels : dec->desc.channels;
+	dec->pixels = (unsigned char *) QOI_MALLOC(
+		(size_t)dec->desc.width * dec->desc.height * dec->channels
+	);
+	if (!dec->pixels) {
+		return 0;
+	}
+	dec->data = (const unsigned char *)data;
+	dec->size = size;
+	dec->frames = frames;
+	dec->dir = dec->data + size - QOI_SEQ_FOOTER_SIZE - (size_t)frames * 8;
+	dec->current = frames;
+	return 1;
+}
+
+/* Find the bytes of frame k. Returns 0 if the directory entry is invalid. */
+static int qoi_seq_find(
+	const qoi_seq_decoder *dec, unsigned int k,
+	const unsigned char **frame, size_t *len
+) {
+	size_t offset[2];
+	unsigned int hi, lo;
+	int p = 0, i;
+
+	for (i = 0; i < 2; i++) {
+		if (k + i == dec->frames) {
+			offset[i] = (size_t)(dec->dir - dec->data);
+			break;
+		}
+		hi = qoi_read_32(dec->dir + (size_t)(k + i) * 8, &p);
+		lo = qoi_read_32(dec->dir + (size_t)(k + i) * 8, &p);
+		p = 0;
+		if (sizeof(size_t) < 8 && hi != 0) {
+			return 0;
+		}
+		offset[i] = (size_t)hi << 31 << 1 | lo;
+	}
+	if (
+		offset[0] < QOI_SEQ_HEADER_SIZE || offset[0] >= offset[1] ||
+		offset[1] > (size_t)(dec->dir - dec->data)
+	) {
+		return 0;
+	}
+	*frame = dec->data + offset[0];
+	*len = offset[1] - offset[0];
+	return 1;
+}
+
+/* Apply frame k to the frame buffer. Returns 0 if it is invalid. */
+static int qoi_seq_apply(qoi_seq_decoder *dec, unsigned int k) {
+	const unsigned char *bytes, *bytes_end;
+	size_t len, npx, pos, skip, count;
+	unsigned char *px_end;
+	qoi_dec_state s;
+	qoi_desc desc;
+	int channels = dec->channels;
+
+	if (!qoi_seq_find(dec, k, &bytes, &len)) {
+		return 0;
+	}
+	npx = (size_t)dec->desc.width * dec->desc.height;
+
+	if (bytes[0] == QOI_SEQ_KEY) {
+		return
+			qoi_probe(bytes + 1, len - 1, &desc) &&
+			desc.width == dec->desc.width && desc.height == dec->desc.height &&
+			qoi_decode_into(bytes + 1, len - 1, &desc, channels, dec->pixels, 0, 0);
+	}
+
+	if (bytes[0] != QOI_SEQ_DELTA || len < 1 + sizeof(qoi_padding)) {
+		return 0;
+	}
+	bytes_end = bytes + len - sizeof(qoi_padding);
+	bytes++;
+	qoi_dec_init(&s);
+	for (pos = 0; pos < npx; pos += count) {
+		if (
+			!qoi_seq_get_varint(&bytes, bytes_end, &skip) || skip > npx - pos ||
+			!qoi_seq_get_varint(&bytes, bytes_end, &count) || count > npx - pos - skip
+		) {
+			return 0;
+		}
+		pos += skip;
+		if (count > 0) {
+			unsigned char *px = dec->pixels + pos * channels;
+			px_end = QOI_DEC_SELECT(channels)(
+				&s, &bytes, bytes_end, px, px + count * channels
+			);
+			if (px_end != px + count * channels || s.run != 0) {
+				return 0;
+			}
+		}
+	}
+	return 1;
+}
+
+const void *qoi_seq_decode_frame(qoi_seq_decoder *dec, unsigned int k) {
+	const unsigned char *frame;
+	unsigned int start;
+	size_t len;
+
+	if (dec == NULL || dec->pixels == NULL || k >= dec->frames) {
+		return NULL;
+	}
+	if (k == dec->current) {
+		return dec->pixels;
+	}
+
+	/* Start at the keyframe before k, unless the current frame is closer */
+	for (start = k; ; start--) {
+		if (dec->current < k && start == dec->current) {
+			start++;
+			break;
+		}
+		if (!qoi_seq_find(dec, start, &frame, &len)) {
+			dec->current = dec->frames;
+			return NULL;
+		}
+		if (frame[0] == QOI_SEQ_KEY) {
+			break;
+		}
+		if (start == 0) {
+			dec->current = dec->frames;
+			return NULL;
+		}
+	}
+
+	for (; start <= k; start++) {
+		if (!qoi_seq_apply(dec, start)) {
+			dec->current = dec->frames;
+			return NULL;
+		}
+	}
+	dec->current = k;
+	return dec->pixels;
+}
+
+void qoi_seq_decoder_close(qoi_seq_decoder *dec) {
+	QOI_FREE(dec->pixels);
+	dec->pixels = NULL;
+}
+
+int qoi_probe(const void *data, size_t size, qoi_desc *desc) {
+	if (data == NULL || desc == NULL) {
+		return 0;
+	}
+	return qoi_dec_header((const unsigned char *)data, size, desc);
+}
+
+void qoi_ctx_init(qoi_ctx *ctx, const qoi_allocator *allocator) {
+	ctx->allocator = allocator;
+	ctx->buf = NULL;
+	ctx->cap = 0;
+}
+
+/* Make sure the context buffer holds at least size bytes. It grows by at
+least half its size, so slowly growing images don't reallocate every time. */
+static unsigned char *qoi_ctx_reserve(qoi_ctx *ctx, size_t size) {
+	size_t cap;
+
+	if (size <= ctx->cap) {
+		return ctx->buf;
+	}
+
+	cap = ctx->cap + ctx->cap / 2;
+	if (cap < size || cap < ctx->cap) {
+		cap = size;
+	}
+	qoi_ctx_trim(ctx, 0);
+	ctx->buf = (unsigned char *) qoi_alloc(ctx->allocator, cap);
+	if (ctx->buf) {
+		ctx->cap = cap;
+	}
+	return ctx->buf;
+}
+
+const void *qoi_ctx_encode(
+	qoi_ctx *ctx, const void *data, const qoi_desc *desc, size_t *out_len
+) {
+	size_t bound;
+
+	if (ctx == NULL || data == NULL || out_len == NULL || !qoi_valid_desc(desc)) {
+		return NULL;
+	}
+
+	bound = qoi_encode_bound(desc);
+	if (
+		!qoi_ctx_reserve(ctx, bound) ||
+		!qoi_encode_into(data, desc, ctx->buf, bound, out_len)
+	) {
+		return NULL;
+	}
+	return ctx->buf;
+}
+
+const void *qoi_ctx_decode(
+	qoi_ctx *ctx, const void *data, size_t size, qoi_desc *desc, int channels
+) {
+	if (
+		ctx == NULL || (channels != 0 && channels != 3 && channels != 4) ||
+		!qoi_probe(data, size, desc)
+	) {
+		return NULL;
+	}
+
+	if (
+		!qoi_ctx_reserve(ctx, (size_t)desc->width * desc->height *
+			(channels ? channels : desc->channels)) ||
+		!qoi_decode_into(data, size, desc, channels, ctx->buf, 0, 0)
+	) {
+		return NULL;
+	}
+	return ctx->buf;
+}
+
+void qoi_ctx_trim(qoi_ctx *ctx, size_t keep) {
+	if (ctx->buf && ctx->cap > keep) {
+		qoi_free(ctx->allocator, ctx->buf);
+		ctx->buf = NULL;
+		ctx->cap = 0;
+	}
+}
+
+void qoi_ctx_free(qoi_ctx *ctx) {
+	qoi_ctx_trim(ctx, 0);
+}
+
+void *qoi_decode(const void *data, int size, qoi_desc *desc, int channels) {
+	if (size < 0) {
+		return NULL;
+	}
+	return qoi_decode_impl(data, size, desc, channels, 1, NULL, NULL);
+}
+
+/* The decoder reads up to this many bytes past the bytes_end it is given */
+#define QOI_DEC_LOOKAHEAD 4
+
+int qoi_decoder_init(qoi_decoder *dec, int channels, qoi_row_fn row, void *user) {
+	if (
+		dec == NULL || row == NULL ||
+		(channels != 0 && channels != 3 && channels != 4)
+	) {
+		return 0;
+	}
+
+	memset(&dec->desc, 0, sizeof(dec->desc));
+	qoi_dec_init(&dec->state);
+	dec->decode = NULL;
+	dec->row = row;
+	dec->read = NULL;
+	dec->user = user;
+	dec->channels = channels;
+	dec->buf = NULL;
+	dec->buf_pos = 0;
+	dec->buf_len = 0;
+	dec->row_len = 0;
+	dec->row_pos = 0;
+	dec->y = 0;
+	dec->pending_len = 0;
+	dec->eof = 0;
+	dec->error = 0;
+	return 1;
+}
+
+/* Decode the chunks that start before bytes_end into rows and hand each
+completed row to the row callback. */
+static int qoi_decoder_rows(
+	qoi_decoder *dec, const unsigned char **bytes_p, const unsigned char *bytes_end
+) {
+	while (dec->y < dec->desc.height) {
+		unsigned char *row_end = dec->buf + dec->row_len;
+		unsigned char *px_pos = dec->decode(
+			&dec->state, bytes_p, bytes_end, dec->buf + dec->row_pos, row_end
+		);
+
+		dec->row_pos = px_pos - dec->buf;
+		if (px_pos < row_end) {
+			return 1;
+		}
+		if (!dec->row(dec->user, dec->buf, dec->y)) {
+			dec->error = 1;
+			return 0;
+		}
+		dec->y++;
+		dec->row_pos = 0;
+	}
+	return 1;
+}
+
+int qoi_decoder_push(qoi_decoder *dec, const void *data, size_t len) {
+	const unsigned char *p = (const unsigned char *)data;
+	const unsigned char *end = p + len;
+
+	if (dec->error || (data == NULL && len != 0)) {
+		return 0;
+	}
+
+	/* Collect the header */
+	if (dec->buf == NULL) {
+		size_t take = QOI_HEADER_SIZE - dec->pending_len;
+		if (take > len) {
+			take = len;
+		}
+		memcpy(dec->pending + dec->pending_len, p, take);
+		dec->pending_len += take;
+		p += take;
+		if (dec->pending_len < QOI_HEADER_SIZE) {
+			return 1;
+		}
+
+		if (!qoi_dec_header(dec->pending, QOI_HEADER_SIZE, &dec->desc)) {
+			dec->error = 1;
+			return 0;
+		}
+		if (dec->channels == 0) {
+			dec->channels = dec->desc.channels;
+		}
+		dec->row_len = (size_t)dec->desc.width * dec->channels;
+		dec->buf = (unsigned char *) QOI_MALLOC(dec->row_len);
+		if (!dec->buf) {
+			dec->error = 1;
+			return 0;
+		}
+		dec->decode = QOI_DEC_SELECT(dec->channels);
+		dec->pending_len = 0;
+	}
+
+	/* Finish a chunk that was split between the last slice and this one. At
+	most QOI_DEC_LOOKAHEAD bytes are pending, so a few bytes of the new slice
+	are enough to complete it. */
+	while (dec->pending_len > 0 && p < end && dec->y < dec->desc.height) {
+		const unsigned char *q = dec->pending;
+		size_t old_len = dec->pending_len;
+		size_t take = sizeof(dec->pending) - old_len;
+		size_t used;
+
+		if (take > (size_t)(end - p)) {
+			take = end - p;
+		}
+		memcpy(dec->pending + old_len, p, take);
+		dec->pending_len += take;
+
+		if (
+			dec->pending_len > QOI_DEC_LOOKAHEAD &&
+			!qoi_decoder_rows(
+				dec, &q, dec->pending + dec->pending_len - QOI_DEC_LOOKAHEAD
+			)
+		) {
+			return 0;
+		}
+
+		used = q - dec->pending;
+		if (used >= old_len) {
+			p += used - old_len;
+			dec->pending_len = 0;
+		}
+		else {
+			p += take;
+			dec->pending_len -= used;
+			memmove(dec->pending, dec->pending + used, dec->pending_len);
+		}
+	}
+
+	/* Decode the slice itself and keep what is left of it for the next one */
+	if (dec->pending_len == 0 && dec->y < dec->desc.height) {
+		if (
+			end - p > QOI_DEC_LOOKAHEAD &&
+			!qoi_decoder_rows(dec, &p, end - QOI_DEC_LOOKAHEAD)
+		) {
+			return 0;
+		}
+		if (dec->y < dec->desc.height) {
+			dec->pending_len = end - p;
+			memcpy(dec->pending, p, dec->pending_len);
+		}
+	}
+	return 1;
+}
+
+int qoi_decoder_finish(qoi_decoder *dec) {
+	int complete =
+		!dec->error && dec->buf != NULL && dec->y == dec->desc.height;
+
+	QOI_FREE(dec->buf);
+	dec->buf = NULL;
+	dec->error = 1;
+	return complete;
+}
+
+/* Move the unread bytes to the front of the input buffer and read more */
+static void qoi_decoder_fill(qoi_decoder *dec) {
+	size_t n;
+
+	dec->buf_len -= dec->buf_pos;
+	memmove(dec->buf, dec->buf + dec->buf_pos, dec->buf_len);
+	dec->buf_pos = 0;
+
+	n = dec->read(dec->user, dec->buf + dec->buf_len, QOI_DECODER_BUFFER_SIZE - dec->buf_len);
+	if (n == 0 || n > QOI_DECODER_BUFFER_SIZE - dec->buf_len) {
+		dec->eof = 1;
+		return;
+	}
+	dec->buf_len += n;
+}
+
+int qoi_decoder_open(qoi_decoder *dec, int channels, qoi_read_fn read, void *user) {
+	if (
+		dec == NULL || read == NULL ||
+		(channels != 0 && channels != 3 && channels != 4)
+	) {
+		return 0;
+	}
+
+	memset(&dec->desc, 0, sizeof(dec->desc));
+	qoi_dec_init(&dec->state);
+	dec->row = NULL;
+	dec->read = read;
+	dec->user = user;
+	dec->buf_pos = 0;
+	dec->buf_len = 0;
+	dec->row_len = 0;
+	dec->row_pos = 0;
+	dec->y = 0;
+	dec->pending_len = 0;
+	dec->eof = 0;
+	dec->error = 0;
+
+	dec->buf = (unsigned char *) QOI_MALLOC(QOI_DECODER_BUFFER_SIZE);
+	if (!dec->buf) {
+		return 0;
+	}
+
+	while (dec->buf_len < QOI_HEADER_SIZE && !dec->eof) {
+		qoi_decoder_fill(dec);
+	}
+	if (!qoi_dec_header(dec->buf, dec->buf_len, &dec->desc)) {
+		QOI_FREE(dec->buf);
+		dec->buf = NULL;
+		return 0;
+	}
+	dec->buf_pos = QOI_HEADER_SIZE;
+
+	dec->channels = channels ? channels : dec->desc.channels;
+	dec->row_len = (size_t)dec->desc.width * dec->channels;
+	dec->decode = QOI_DEC_SELECT(dec->channels);
+	return 1;
+}
+
+unsigned int qoi_decode_rows(qoi_decoder *dec, void *out, unsigned int nrows) {
+	unsigned char *pixels = (unsigned char *)out, *pixels_end;
+
+	if (dec->buf == NULL || dec->read == NULL || out == NULL || dec->error) {
+		return 0;
+	}
+
+	if (nrows > dec->desc.height - dec->y) {
+		nrows = dec->desc.height - dec->y;
+	}
+	pixels_end = pixels + dec->row_len * nrows;
+
+	while (pixels < pixels_end) {
+		const unsigned char *bytes = dec->buf + dec->buf_pos;
+		const unsigned char *bytes_end = dec->buf_len - dec->buf_pos > QOI_DEC_LOOKAHEAD
+			? dec->buf + dec->buf_len - QOI_DEC_LOOKAHEAD
+			: bytes;
+
+		pixels = dec->decode(&dec->state, &bytes, bytes_end, pixels, pixels_end);
+		dec->buf_pos = bytes - dec->buf;
+
+		if (pixels < pixels_end) {
+			if (dec->eof) {
+				/* Truncated data; only report the complete rows */
+				nrows = (unsigned int)((pixels - (unsigned char *)out) / dec->row_len);
+				dec->error = 1;
+				break;
+			}
+			qoi_decoder_fill(dec);
+		}
+	}
+
+	dec->y += nrows;
+	return nrows;
+}
+
+void qoi_decoder_close(qoi_decoder *dec) {
+	QOI_FREE(dec->buf);
+	dec->buf = NULL;
+}
+
+size_t qoi_encode_io(const void *data, const qoi_desc *desc, const qoi_io *io) {
+	qoi_encoder enc;
+
+	if (data == NULL || io == NULL || !qoi_encoder_init(&enc, desc, io->write, io->user)) {
+		return 0;
+	}
+	qoi_encoder_push_rows(&enc, data, desc->height);
+	return qoi_encoder_finish(&enc) ? enc.size : 0;
+}
+
+void *qoi_decode_io(const qoi_io *io, qoi_desc *desc, int channels) {
+	qoi_decoder dec;
+	unsigned char *pixels;
+
+	if (
+		io == NULL || desc == NULL ||
+		!qoi_decoder_open(&dec, channels, io->read, io->user)
+	) {
+		return NULL;
+	}
+
+	pixels = (unsigned char *) QOI_MALLOC(dec.row_len * dec.desc.height);
+	if (!pixels) {
+		qoi_decoder_close(&dec);
+		return NULL;
+	}
+
+	if (qoi_decode_rows(&dec, pixels, dec.desc.height) < dec.desc.height) {
+		QOI_FREE(pixels);
+		pixels = NULL;
+	}
+	qoi_decoder_close(&dec);
+	*desc = dec.desc;
+	return pixels;
+}
+
+/* Seek index
+
+The seek index follows the end marker of the image:
+
+struct qoi_seek_entry_t {
+	uint64_t offset;     // file offset of the first chunk not yet decoded (BE)
+	uint32_t y;          // row at which this checkpoint was taken (BE)
+	uint32_t px;         // previous pixel value, RGBA (BE)
+	uint32_t skip;       // pixels at offset that still belong to rows before y (BE)
+	uint32_t index[64];  // the 64 entry index, RGBA (BE)
+};
+
+struct qoi_seek_footer_t {
+	uint32_t count;          // number of entries (BE)
+	uint32_t rows_per_entry; // entry k is taken at row k * rows_per_entry (BE)
+	char     magic[4];       // magic bytes "qoix"
+};
+
+The checkpoints are taken from the encoder state at the start of a row. A run
+that is still pending in the encoder at that point is emitted later, so a
+decoder that resumes at a checkpoint first drops skip pixels. */
+
+#define QOI_SEEK_MAGIC \
+	(((unsigned int)'q') << 24 | ((unsigned int)'o') << 16 | \
+	 ((unsigned int)'i') <<  8 | ((unsigned int)'x'))
+#define QOI_SEEK_ENTRY_SIZE (8 + 4 + 4 + 4 + 64 * 4)
+#define QOI_SEEK_FOOTER_SIZE 12
+
+typedef struct {
+	const unsigned char *entries;
+	unsigned int count;
+	unsigned int rows;
+	size_t chunks_end;
+} qoi_seek_index;
+
+static unsigned int qoi_seek_rgba(qoi_rgba_t px) {
+	return
+		(unsigned int)px.rgba.r << 24 | (unsigned int)px.rgba.g << 16 |
+		(unsigned int)px.rgba.b << 8 | px.rgba.a;
+}
+
+static qoi_rgba_t qoi_seek_px(unsigned int v) {
+	qoi_rgba_t px;
+	px.rgba.r = (v >> 24) & 0xff;
+	px.rgba.g = (v >> 16) & 0xff;
+	px.rgba.b = (v >>  8) & 0xff;
+	px.rgba.a = v & 0xff;
+	return px;
+}
+
+static unsigned char *qoi_seek_write_entry(
+	unsigned char *bytes, const qoi_enc_state *s, size_t offset, unsigned int y
+) {
+	int p = 0, i;
+	qoi_write_32(bytes, &p, (unsigned int)(offset >> 31 >> 1));
+	qoi_write_32(bytes, &p, (unsigned int)(offset & 0xffffffff));
+	qoi_write_32(bytes, &p, y);
+	qoi_write_32(bytes, &p, qoi_seek_rgba(s->px_prev));
+	qoi_write_32(bytes, &p, (unsigned int)s->run);
+	for (i = 0; i < 64; i++) {
+		qoi_write_32(bytes, &p, qoi_seek_rgba(s->index[i]));
+	}
+	return bytes + p;
+}
+
+/* Find and validate the seek index. Returns 0 if there is none. */
+static int qoi_seek_index_read(
+	const unsigned char *bytes, size_t size, const qoi_desc *desc,
+	qoi_seek_index *ix
+) {
+	const unsigned char *footer;
+	size_t trailer;
+	int p = 0;
+
+	if (size < QOI_HEADER_SIZE + sizeof(qoi_padding) + QOI_SEEK_FOOTER_SIZE) {
+		return 0;
+	}
+	footer = bytes + size - QOI_SEEK_FOOTER_SIZE;
+	ix->count = qoi_read_32(footer, &p);
+	ix->rows = qoi_read_32(footer, &p);
+	if (
+		qoi_read_32(footer, &p) != QOI_SEEK_MAGIC ||
+		ix->rows == 0 || ix->count != (desc->height - 1) / ix->rows + 1 ||
+		ix->count > (
+			size - QOI_HEADER_SIZE - sizeof(qoi_padding) - QOI_SEEK_FOOTER_SIZE
+		) / QOI_SEEK_ENTRY_SIZE
+	) {
+		return 0;
+	}
+
+	trailer = size - QOI_SEEK_FOOTER_SIZE - (size_t)ix->count * QOI_SEEK_ENTRY_SIZE;
+	ix->entries = bytes + trailer;
+	ix->chunks_end = trailer - sizeof(qoi_padding);
+	return memcmp(bytes + ix->chunks_end, qoi_padding, sizeof(qoi_padding)) == 0;
+}
+
+/* Restore the decoder state of entry k. Returns 0 if the entry is invalid. */
+static int qoi_seek_restore(
+	const qoi_seek_index *ix, unsigned int k, qoi_dec_state *s,
+	size_t *offset, size_t *skip
+) {
+	const unsigned char *entry = ix->entries + (size_t)k * QOI_SEEK_ENTRY_SIZE;
+	unsigned int hi, lo;
+	int p = 0, i;
+
+	hi = qoi_read_32(entry, &p);
+	lo = qoi_read_32(entry, &p);
+	if (sizeof(size_t) < 8 && hi != 0) {
+		return 0;
+	}
+	*offset = (size_t)hi << 31 << 1 | lo;
+	if (
+		qoi_read_32(entry, &p) != k * ix->rows ||
+		*offset < QOI_HEADER_SIZE || *offset > ix->chunks_end
+	) {
+		return 0;
+	}
+	s->px = qoi_seek_px(qoi_read_32(entry, &p));
+	*skip = qoi_read_32(entry, &p);
+	for (i = 0; i < 64; i++) {
+		s->index[i] = qoi_seek_px(qoi_read_32(entry, &p));
+	}
+	s->run = 0;
+	return 1;
+}
+
+#define QOI_SEEK_DEFAULT_PX (64 * 1024)
+
+void *qoi_encode_seekable(
+	const void *data, const qoi_desc *desc, unsigned int rows_per_entry,
+	size_t *out_len
+) {
+	unsigned char *bytes, *b;
+	const unsigned char *pixels;
+	qoi_enc_state s;
+	qoi_enc_fn encode;
+	size_t row_len, max_size;
+	unsigned int y, count;
+	int bpp, p;
+
+	if (data == NULL || out_len == NULL || !qoi_valid_desc(desc)) {
+		return NULL;
+	}
+
+	if (rows_per_entry == 0) {
+		rows_per_entry = QOI_SEEK_DEFAULT_PX / desc->width;
+		if (rows_per_entry == 0) {
+			rows_per_entry = 1;
+		}
+	}
+	count = (desc->height - 1) / rows_per_entry + 1;
+
+	max_size = qoi_encode_bound(desc);
+	if (count > (QOI_SIZE_MAX - max_size - QOI_SEEK_FOOTER_SIZE) / QOI_SEEK_ENTRY_SIZE) {
+		return NULL;
+	}
+	max_size += (size_t)count * QOI_SEEK_ENTRY_SIZE + QOI_SEEK_FOOTER_SIZE;
+
+	bytes = (unsigned char *) QOI_MALLOC(max_size);
+	if (!bytes) {
+		return NULL;
+	}
+
+	/* The entries are collected at the end of the buffer, and moved behind the
+	end marker once the size of the image data is known. */
+	encode = qoi_enc_select(QOI_LAYOUT_OF(desc->channels), desc->channels, &bpp);
+	row_len = (size_t)desc->width * bpp;
+	pixels = (const unsigned char *)data;
+	b = qoi_enc_header(bytes, desc);
+	qoi_enc_init(&s);
+	for (y = 0; y < desc->height; y += rows_per_entry) {
+		unsigned int rows = desc->height - y < rows_per_entry
+			? desc->height - y
+			: rows_per_entry;
+		qoi_seek_write_entry(
+			bytes + max_size - QOI_SEEK_FOOTER_SIZE -
+				(size_t)(count - y / rows_per_entry) * QOI_SEEK_ENTRY_SIZE,
+			&s, b - bytes, y
+		);
+		b = encode(&s, pixels + row_len * y, pixels + row_len * (y + rows), b);
+	}
+	b = qoi_enc_flush(&s, b);
+	memcpy(b, qoi_padding, sizeof(qoi_padding));
+	b += sizeof(qoi_padding);
+
+	memmove(
+		b, bytes + max_size - QOI_SEEK_FOOTER_SIZE - (size_t)count * QOI_SEEK_ENTRY_SIZE,
+		(size_t)count * QOI_SEEK_ENTRY_SIZE
+	);
+	b += (size_t)count * QOI_SEEK_ENTRY_SIZE;
+	p = 0;
+	qoi_write_32(b, &p, count);
+	qoi_write_32(b, &p, rows_per_entry);
+	qoi_write_32(b, &p, QOI_SEEK_MAGIC);
+	b += p;
+
+	*out_len = b - bytes;
+	return bytes;
+}
+
+/* Set up the decoder to continue at row y0: restore the last checkpoint at or
+before y0 (if ix is not NULL) or start at the beginning. Returns the number of
+pixels before row y0 that are still to be walked over. */
+static size_t qoi_seek_start(
+	const unsigned char *bytes, const qoi_desc *desc, const qoi_seek_index *ix,
+	unsigned int y0, qoi_dec_state *s, const unsigned char **bytes_p
+) {
+	size_t offset, skip;
+
+	if (ix) {
+		unsigned int k = y0 / ix->rows;
+		if (qoi_seek_restore(ix, k, s, &offset, &skip)) {
+			*bytes_p = bytes + offset;
+			return skip + (size_t)desc->width * (y0 - k * ix->rows);
+		}
+	}
+
+	qoi_dec_init(s);
+	*bytes_p = bytes + QOI_HEADER_SIZE;
+	return (size_t)desc->width * y0;
+}
+
+/* Decode the rows y0 to y1 - 1 into out */
+static void qoi_seek_decode(
+	const unsigned char *bytes, size_t size, const qoi_desc *desc,
+	const qoi_seek_index *ix, int channels,
+	unsigned int y0, unsigned int y1, unsigned char *out
+) {
+	const unsigned char *chunks_end = bytes + (ix ? ix->chunks_end : size - sizeof(qoi_padding));
+	const unsigned char *p;
+	unsigned char *px_pos, *pixels_end;
+	qoi_dec_state s;
+	size_t skip;
+
+	skip = qoi_seek_start(bytes, desc, ix, y0, &s, &p);
+	qoi_dec_walk(&s, &p, chunks_end, skip);
+
+	pixels_end = out + (size_t)desc->width * (y1 - y0) * channels;
+	px_pos = QOI_DEC_SELECT(channels)(&s, &p, chunks_end, out, pixels_end);
+
+	/* Truncated data; repeat the last pixel */
+	for (; px_pos < pixels_end; px_pos += channels) {
+		memcpy(px_pos, &s.px, channels);
+	}
+}
+
+typedef struct {
+	const unsigned char *bytes;
+	size_t size;
+	const qoi_desc *desc;
+	const qoi_seek_index *ix;
+	int channels;
+	unsigned int y0, y1;
+	unsigned char *out;
+} qoi_seek_job;
+
+static void qoi_seek_decode_job(void *job) {
+	qoi_seek_job *j = (qoi_seek_job *)job;
+	qoi_seek_decode(
+		j->bytes, j->size, j->desc, j->ix, j->channels, j->y0, j->y1, j->out
+	);
+}
+
+void *qoi_decode_mt(
+	const void *data, size_t size, qoi_desc *desc, int channels, int nthreads
+) {
+	const unsigned char *bytes = (const unsigned char *)data;
+	unsigned char *pixels;
+	qoi_seek_index ix;
+	qoi_seek_job *jobs;
+	size_t row_len;
+	int k;
 
 	if (
-		desc->width == 0 || desc->height == 0 || 
-		desc->channels < 3 || desc->channels > 4 ||
-		desc->colorspace > 1 ||
-		header_magic != QOI_MAGIC ||
-		desc->height >= QOI_PIXELS_MAX / desc->width
+		data == NULL || desc == NULL ||
+		(channels != 0 && channels != 3 && channels != 4) ||
+		size < QOI_HEADER_SIZE + sizeof(qoi_padding) ||
+		!qoi_dec_header(bytes, size, desc)
 	) {
 		return NULL;
 	}
 
+	if (!qoi_seek_index_read(bytes, size, desc, &ix)) {
+		return qoi_decode64(data, size, desc, channels);
+	}
+	if (nthreads > (int)ix.count) {
+		nthreads = (int)ix.count;
+	}
+	if (nthreads < 1) {
+		nthreads = 1;
+	}
+
 	if (channels == 0) {
 		channels = desc->channels;
 	}
+	row_len = (size_t)desc->width * channels;
+	pixels = (unsigned char *) QOI_MALLOC(row_len * desc->height);
+	jobs = (qoi_seek_job *) QOI_MALLOC(sizeof(qoi_seek_job) * nthreads);
+	if (!pixels || !jobs) {
+		QOI_FREE(pixels);
+		QOI_FREE(jobs);
+		return NULL;
+	}
+
+	for (k = 0; k < nthreads; k++) {
+		unsigned int e0 = (unsigned int)((size_t)ix.count * k / nthreads);
+		unsigned int e1 = (unsigned int)((size_t)ix.count * (k + 1) / nthreads);
+		jobs[k].bytes = bytes;
+		jobs[k].size = size;
+		jobs[k].desc = desc;
+		jobs[k].ix = &ix;
+		jobs[k].channels = channels;
+		jobs[k].y0 = e0 * ix.rows;
+		jobs[k].y1 = k == nthreads - 1 ? desc->height : e1 * ix.rows;
+		jobs[k].out = pixels + row_len * jobs[k].y0;
+	}
+	qoi_parallel(qoi_seek_decode_job, jobs, sizeof(qoi_seek_job), nthreads);
+
+	QOI_FREE(jobs);
+	return pixels;
+}
+
+void *qoi_decode_rows_at(
+	const void *data, size_t size, qoi_desc *desc, int channels,
+	unsigned int y0, unsigned int y1
+) {
+	const unsigned char *bytes = (const unsigned char *)data;
+	unsigned char *pixels;
+	qoi_seek_index ix;
+	int has_index;
+
+	if (
+		data == NULL || desc == NULL ||
+		(channels != 0 && channels != 3 && channels != 4) ||
+		size < QOI_HEADER_SIZE + sizeof(qoi_padding) ||
+		!qoi_dec_header(bytes, size, desc) ||
+		y0 >= y1 || y1 > desc->height
+	) {
+		return NULL;
+	}
 
-	px_len = desc->width * desc->height * channels;
-	pixels = (unsigned char *) QOI_MALLOC(px_len);
+	if (channels == 0) {
+		channels = desc->channels;
+	}
+	pixels = (unsigned char *) QOI_MALLOC((size_t)desc->width * (y1 - y0) * channels);
 	if (!pixels) {
 		return NULL;
 	}
 
-	QOI_ZEROARR(index);
-	px.rgba.r = 0;
-	px.rgba.g = 0;
-	px.rgba.b = 0;
-	px.rgba.a = 255;
+	has_index = qoi_seek_index_read(bytes, size, desc, &ix);
+	qoi_seek_decode(bytes, size, desc, has_index ? &ix : NULL, channels, y0, y1, pixels);
+	return pixels;
+}
 
-	chunks_len = size - sizeof(qoi_padding);
-	for (px_pos = 0; px_pos < px_len; px_pos += channels) {
-		if (run > 0) {
-			run--;
-		}
-		else if (p < chunks_len) {
-			int b1 = bytes[p++];
+void *qoi_decode_region(
+	const void *data, size_t size, qoi_desc *desc, int channels,
+	unsigned int x, unsigned int y, unsigned int w, unsigned int h
+) {
+	const unsigned char *bytes = (const unsigned char *)data;
+	const unsigned char *p, *chunks_end;
+	unsigned char *pixels, *row, *px_pos;
+	qoi_seek_index ix;
+	qoi_dec_state s;
+	qoi_dec_fn decode;
+	size_t skip, row_len;
+	unsigned int r;
+	int has_index;
 
-			if (b1 == QOI_OP_RGB) {
-				px.rgba.r = bytes[p++];
-				px.rgba.g = bytes[p++];
-				px.rgba.b = bytes[p++];
-			}
-			else if (b1 == QOI_OP_RGBA) {
-				px.rgba.r = bytes[p++];
-				px.rgba.g = bytes[p++];
-				px.rgba.b = bytes[p++];
-				px.rgba.a = bytes[p++];
-			}
-			else if ((b1 & QOI_MASK_2) == QOI_OP_INDEX) {
-				px = index[b1];
-			}
-			else if ((b1 & QOI_MASK_2) == QOI_OP_DIFF) {
-				px.rgba.r += ((b1 >> 4) & 0x03) - 2;
-				px.rgba.g += ((b1 >> 2) & 0x03) - 2;
-				px.rgba.b += ( b1       & 0x03) - 2;
-			}
-			else if ((b1 & QOI_MASK_2) == QOI_OP_LUMA) {
-				int b2 = bytes[p++];
-				int vg = (b1 & 0x3f) - 32;
-				px.rgba.r += vg - 8 + ((b2 >> 4) & 0x0f);
-				px.rgba.g += vg;
-				px.rgba.b += vg - 8 +  (b2       & 0x0f);
-			}
-			else if ((b1 & QOI_MASK_2) == QOI_OP_RUN) {
-				run = (b1 & 0x3f);
-			}
+	if (
+		data == NULL || desc == NULL ||
+		(channels != 0 && channels != 3 && channels != 4) ||
+		size < QOI_HEADER_SIZE + sizeof(qoi_padding) ||
+		!qoi_dec_header(bytes, size, desc) ||
+		w == 0 || h == 0 ||
+		x > desc->width || w > desc->width - x ||
+		y > desc->height || h > desc->height - y
+	) {
+		return NULL;
+	}
 
-			index[QOI_COLOR_HASH(px) % 64] = px;
-		}
+	if (channels == 0) {
+		channels = desc->channels;
+	}
+	row_len = (size_t)w * channels;
+	pixels = (unsigned char *) QOI_MALLOC(row_len * h);
+	if (!pixels) {
+		return NULL;
+	}
 
-		if (channels == 4) { 
-			*(qoi_rgba_t*)(pixels + px_pos) = px;
-		}
-		else {
-			pixels[px_pos + 0] = px.rgba.r;
-			pixels[px_pos + 1] = px.rgba.g;
-			pixels[px_pos + 2] = px.rgba.b;
+	has_index = qoi_seek_index_read(bytes, size, desc, &ix);
+	chunks_end = bytes + (has_index ? ix.chunks_end : size - sizeof(qoi_padding));
+	skip = qoi_seek_start(bytes, desc, has_index ? &ix : NULL, y, &s, &p) + x;
+	decode = QOI_DEC_SELECT(channels);
+
+	for (r = 0, row = pixels; r < h; r++, row += row_len) {
+		qoi_dec_walk(&s, &p, chunks_end, skip);
+		px_pos = decode(&s, &p, chunks_end, row, row + row_len);
+
+		/* Truncated data; repeat the last pixel */
+		for (; px_pos < row + row_len; px_pos += channels) {
+			memcpy(px_pos, &s.px, channels);
 		}
+		skip = desc->width - w;
 	}
 
 	return pixels;
@@ -614,45 +4419,167 @@ void *qoi_decode(const void *data, int size, qoi_desc *desc, int channels) {
 
 #ifndef QOI_NO_STDIO
 #include <stdio.h>
+#ifdef _WIN32
+	#include <sys/types.h>
+	#include <sys/stat.h>
+#elif defined(QOI_POSIX)
+	#include <sys/stat.h>
+	#include <errno.h>
+	#include <fcntl.h>
+	#include <unistd.h>
+	#ifndef QOI_NO_MMAP
+		#include <sys/mman.h>
+		#define QOI_MMAP
+	#endif
+#endif
 
-int qoi_write(const char *filename, const void *data, const qoi_desc *desc) {
-	FILE *f = fopen(filename, "wb");
-	int size;
-	void *encoded;
+/* Determine the size of an open file. Unlike ftell(), fstat() reports sizes
+beyond 2GB on all platforms. */
+static int qoi_file_size(FILE *f, size_t *size) {
+#if defined(_WIN32)
+	struct _stat64 st;
+	if (_fstat64(_fileno(f), &st) != 0) {
+		return 0;
+	}
+	if (st.st_size < 0 || (unsigned long long)st.st_size > QOI_SIZE_MAX) {
+		return 0;
+	}
+	*size = (size_t)st.st_size;
+#elif defined(QOI_POSIX)
+	struct stat st;
+	if (fstat(fileno(f), &st) != 0) {
+		return 0;
+	}
+	if (st.st_size < 0 || (unsigned long long)st.st_size > QOI_SIZE_MAX) {
+		return 0;
+	}
+	*size = (size_t)st.st_size;
+#else
+	long len;
+	fseek(f, 0, SEEK_END);
+	len = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	if (len < 0) {
+		return 0;
+	}
+	*size = (size_t)len;
+#endif
+	return 1;
+}
 
-	if (!f) {
+static int qoi_write_file(void *user, const void *data, size_t len) {
+	return fwrite(data, 1, len, (FILE *)user) == len;
+}
+
+static size_t qoi_write_impl(
+	const char *filename, const void *data, const qoi_desc *desc, int pixels_max
+) {
+	qoi_io io;
+	size_t size;
+
+	if (
+		data == NULL || !qoi_valid_desc(desc) ||
+		(pixels_max && !qoi_within_pixels_max(desc))
+	) {
 		return 0;
 	}
 
-	encoded = qoi_encode(data, desc, &size);
-	if (!encoded) {
-		fclose(f);
+	io.read = NULL;
+	io.write = qoi_write_file;
+	io.user = fopen(filename, "wb");
+	if (!io.user) {
 		return 0;
-	}	
-	
-	fwrite(encoded, 1, size, f);
-	fclose(f);
-	
-	QOI_FREE(encoded);
+	}
+
+	/* Encode through a fixed size buffer that is written out whenever it
+	fills up, instead of allocating the worst case for the whole image */
+	size = qoi_encode_io(data, desc, &io);
+	if (fclose((FILE *)io.user) != 0) {
+		size = 0;
+	}
 	return size;
 }
 
-void *qoi_read(const char *filename, qoi_desc *desc, int channels) {
-	FILE *f = fopen(filename, "rb");
-	int size, bytes_read;
+size_t qoi_write64(const char *filename, const void *data, const qoi_desc *desc) {
+	return qoi_write_impl(filename, data, desc, 0);
+}
+
+int qoi_write(const char *filename, const void *data, const qoi_desc *desc) {
+	return (int)qoi_write_impl(filename, data, desc, 1);
+}
+
+#ifdef QOI_MMAP
+/* Decode straight from a read-only mapping of the file, without copying it
+into a buffer first. Sets *mapped to 0 if the file could not be mapped (e.g.
+a pipe or an empty file) so the caller can fall back to reading it. Like
+any mapped file, the file must not be truncated while it is being decoded. */
+static void *qoi_read_mapped(
+	const char *filename, qoi_desc *desc, int channels, int pixels_max,
+	int *mapped
+) {
+	struct stat st;
+	void *data, *pixels;
+	size_t size;
+	int flags = O_RDONLY;
+	int fd;
+
+	*mapped = 0;
+	#ifdef O_CLOEXEC
+		flags |= O_CLOEXEC;
+	#endif
+	fd = open(filename, flags);
+	if (fd < 0) {
+		return NULL;
+	}
+	if (
+		fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size <= 0 ||
+		(unsigned long long)st.st_size > QOI_SIZE_MAX
+	) {
+		close(fd);
+		return NULL;
+	}
+	size = (size_t)st.st_size;
+
+	data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) {
+		return NULL;
+	}
+	posix_madvise(data, size, POSIX_MADV_SEQUENTIAL);
+
+	*mapped = 1;
+	pixels = qoi_decode_impl(data, size, desc, channels, pixels_max, NULL, NULL);
+	munmap(data, size);
+	return pixels;
+}
+#endif
+
+static void *qoi_read_impl(
+	const char *filename, qoi_desc *desc, int channels, int pixels_max
+) {
+	FILE *f;
+	size_t size, bytes_read;
 	void *pixels, *data;
 
+#ifdef QOI_MMAP
+	{
+		int mapped;
+		pixels = qoi_read_mapped(filename, desc, channels, pixels_max, &mapped);
+		if (mapped) {
+			return pixels;
+		}
+	}
+#endif
+
+	f = fopen(filename, "rb");
 	if (!f) {
 		return NULL;
 	}
 
-	fseek(f, 0, SEEK_END);
-	size = ftell(f);
-	if (size <= 0) {
+	if (!qoi_file_size(f, &size) || size == 0) {
 		fclose(f);
 		return NULL;
 	}
-	fseek(f, 0, SEEK_SET);
 
 	data = QOI_MALLOC(size);
 	if (!data) {
@@ -663,10 +4590,315 @@ void *qoi_read(const char *filename, qoi_desc *desc, int channels) {
 	bytes_read = fread(data, 1, size, f);
 	fclose(f);
 
-	pixels = qoi_decode(data, bytes_read, desc, channels);
+	pixels = qoi_decode_impl(data, bytes_read, desc, channels, pixels_max, NULL, NULL);
 	QOI_FREE(data);
 	return pixels;
 }
 
+void *qoi_read64(const char *filename, qoi_desc *desc, int channels) {
+	return qoi_read_impl(filename, desc, channels, 0);
+}
+
+void *qoi_read(const char *filename, qoi_desc *desc, int channels) {
+	return qoi_read_impl(filename, desc, channels, 1);
+}
+
+int qoi_read_header(const char *filename, qoi_desc *desc) {
+	unsigned char header[QOI_HEADER_SIZE];
+	size_t bytes_read;
+
+	if (filename == NULL || desc == NULL) {
+		return 0;
+	}
+
+#if defined(QOI_POSIX)
+	{
+		ssize_t n;
+		int flags = O_RDONLY;
+		int fd;
+		#ifdef O_CLOEXEC
+			flags |= O_CLOEXEC;
+		#endif
+		fd = open(filename, flags);
+		if (fd < 0) {
+			return 0;
+		}
+		n = pread(fd, header, sizeof(header), 0);
+		close(fd);
+		bytes_read = n < 0 ? 0 : (size_t)n;
+	}
+#else
+	{
+		FILE *f = fopen(filename, "rb");
+		if (!f) {
+			return 0;
+		}
+		setvbuf(f, NULL, _IONBF, 0);
+		bytes_read = fread(header, 1, sizeof(header), f);
+		fclose(f);
+	}
+#endif
+
+	return qoi_dec_header(header, bytes_read, desc);
+}
+
+#ifdef QOI_POSIX
+/* Read-ahead for qoi_read_direct. A helper thread reads the file into a ring
+of QOI_READ_AHEAD_BUFFERS aligned buffers, ahead of the decoder that consumes
+them through qoi_ra_read. Without a helper thread, qoi_ra_read reads each
+buffer itself. */
+#define QOI_READ_AHEAD_ALIGN 4096
+
+typedef struct {
+	int fd;
+	int direct;
+	unsigned char *mem;
+	unsigned char *bufs[QOI_READ_AHEAD_BUFFERS];
+	size_t lens[QOI_READ_AHEAD_BUFFERS];
+	unsigned long long offset;
+	int head;     /* buffer being consumed */
+	int filled;   /* number of buffers ready, starting at head */
+	int holding;  /* whether the decoder is still reading from head */
+	size_t pos;   /* read position in the head buffer */
+	int eof;
+	int error;    /* errno of a failed read, 0 if none */
+	int stop;
+	int threaded;
+	qoi_thread thread;
+#ifndef QOI_NO_THREADS
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+#endif
+} qoi_ra;
+
+static size_t qoi_ra_read_block(qoi_ra *ra, unsigned char *buf) {
+	ssize_t n;
+
+	do {
+		n = read(ra->fd, buf, QOI_READ_AHEAD_SIZE);
+	} while (n < 0 && errno == EINTR);
+
+	/* Some file systems accept O_DIRECT in open() but refuse the read */
+	#ifdef O_DIRECT
+	if (n < 0 && errno == EINVAL && ra->direct) {
+		ra->direct = 0;
+		if (fcntl(ra->fd, F_SETFL, fcntl(ra->fd, F_GETFL) & ~O_DIRECT) == 0) {
+			return qoi_ra_read_block(ra, buf);
+		}
+	}
+	#endif
+	if (n < 0) {
+		ra->error = errno;
+		return 0;
+	}
+	if (n == 0) {
+		return 0;
+	}
+
+	#ifdef POSIX_FADV_DONTNEED
+	if (!ra->direct) {
+		posix_fadvise(ra->fd, (off_t)ra->offset, (off_t)n, POSIX_FADV_DONTNEED);
+	}
+	#endif
+	ra->offset += (unsigned long long)n;
+	return (size_t)n;
+}
+
+#ifndef QOI_NO_THREADS
+static void qoi_ra_main(void *arg) {
+	qoi_ra *ra = (qoi_ra *)arg;
+	size_t n;
+	int i;
+
+	for (;;) {
+		pthread_mutex_lock(&ra->lock);
+		while (ra->filled == QOI_READ_AHEAD_BUFFERS && !ra->stop) {
+			pthread_cond_wait(&ra->cond, &ra->lock);
+		}
+		if (ra->stop) {
+			pthread_mutex_unlock(&ra->lock);
+			return;
+		}
+		i = (ra->head + ra->filled) % QOI_READ_AHEAD_BUFFERS;
+		pthread_mutex_unlock(&ra->lock);
+
+		n = qoi_ra_read_block(ra, ra->bufs[i]);
+
+		pthread_mutex_lock(&ra->lock);
+		ra->lens[i] = n;
+		if (n > 0) {
+			ra->filled++;
+		}
+		else {
+			ra->eof = 1;
+		}
+		pthread_cond_broadcast(&ra->cond);
+		pthread_mutex_unlock(&ra->lock);
+		if (n == 0) {
+			return;
+		}
+	}
+}
+#endif
+
+/* Move on to the next buffer; returns 0 at the end of the file */
+static int qoi_ra_next(qoi_ra *ra) {
+#ifndef QOI_NO_THREADS
+	if (ra->threaded) {
+		pthread_mutex_lock(&ra->lock);
+		if (ra->holding) {
+			ra->head = (ra->head + 1) % QOI_READ_AHEAD_BUFFERS;
+			ra->filled--;
+			ra->holding = 0;
+			pthread_cond_broadcast(&ra->cond);
+		}
+		while (ra->filled == 0 && !ra->eof) {
+			pthread_cond_wait(&ra->cond, &ra->lock);
+		}
+		ra->holding = ra->filled > 0;
+		pthread_mutex_unlock(&ra->lock);
+		ra->pos = 0;
+		return ra->holding;
+	}
+#endif
+	ra->lens[0] = ra->eof ? 0 : qoi_ra_read_block(ra, ra->bufs[0]);
+	ra->eof = ra->lens[0] == 0;
+	ra->holding = !ra->eof;
+	ra->pos = 0;
+	return ra->holding;
+}
+
+static size_t qoi_ra_read(void *user, void *buf, size_t len) {
+	qoi_ra *ra = (qoi_ra *)user;
+	size_t n;
+
+	if ((!ra->holding || ra->pos == ra->lens[ra->head]) && !qoi_ra_next(ra)) {
+		return 0;
+	}
+	n = ra->lens[ra->head] - ra->pos;
+	if (n > len) {
+		n = len;
+	}
+	memcpy(buf, ra->bufs[ra->head] + ra->pos, n);
+	ra->pos += n;
+	return n;
+}
+
+static int qoi_ra_open(qoi_ra *ra, const char *filename) {
+	int flags = O_RDONLY;
+	size_t misalign;
+	int i;
+
+	#ifdef O_CLOEXEC
+		flags |= O_CLOEXEC;
+	#endif
+	ra->direct = 0;
+	ra->fd = -1;
+	#ifdef O_DIRECT
+		ra->fd = open(filename, flags | O_DIRECT);
+		ra->direct = ra->fd >= 0;
+	#endif
+	if (ra->fd < 0) {
+		ra->fd = open(filename, flags);
+	}
+	if (ra->fd < 0) {
+		return 0;
+	}
+	#ifdef F_NOCACHE
+		ra->direct = fcntl(ra->fd, F_NOCACHE, 1) == 0;
+	#endif
+	#ifdef POSIX_FADV_SEQUENTIAL
+		if (!ra->direct) {
+			posix_fadvise(ra->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+		}
+	#endif
+
+	/* O_DIRECT needs buffers aligned to the block size of the device */
+	ra->mem = (unsigned char *) QOI_MALLOC(
+		(size_t)QOI_READ_AHEAD_SIZE * QOI_READ_AHEAD_BUFFERS + QOI_READ_AHEAD_ALIGN
+	);
+	if (!ra->mem) {
+		close(ra->fd);
+		return 0;
+	}
+	misalign = (size_t)ra->mem % QOI_READ_AHEAD_ALIGN;
+	for (i = 0; i < QOI_READ_AHEAD_BUFFERS; i++) {
+		ra->bufs[i] = ra->mem + (QOI_READ_AHEAD_ALIGN - misalign) +
+			(size_t)i * QOI_READ_AHEAD_SIZE;
+		ra->lens[i] = 0;
+	}
+	ra->offset = 0;
+	ra->head = 0;
+	ra->filled = 0;
+	ra->holding = 0;
+	ra->pos = 0;
+	ra->eof = 0;
+	ra->error = 0;
+	ra->stop = 0;
+	ra->threaded = 0;
+
+	#ifndef QOI_NO_THREADS
+	if (pthread_mutex_init(&ra->lock, NULL) == 0) {
+		if (pthread_cond_init(&ra->cond, NULL) == 0) {
+			ra->threaded = qoi_thread_spawn(&ra->thread, qoi_ra_main, ra);
+			if (!ra->threaded) {
+				pthread_cond_destroy(&ra->cond);
+			}
+		}
+		if (!ra->threaded) {
+			pthread_mutex_destroy(&ra->lock);
+		}
+	}
+	#endif
+	return 1;
+}
+
+static void qoi_ra_close(qoi_ra *ra) {
+	#ifndef QOI_NO_THREADS
+	if (ra->threaded) {
+		pthread_mutex_lock(&ra->lock);
+		ra->stop = 1;
+		pthread_cond_broadcast(&ra->cond);
+		pthread_mutex_unlock(&ra->lock);
+		qoi_thread_join(&ra->thread);
+		pthread_cond_destroy(&ra->cond);
+		pthread_mutex_destroy(&ra->lock);
+	}
+	#endif
+	close(ra->fd);
+	QOI_FREE(ra->mem);
+}
+#endif
+
+void *qoi_read_direct(const char *filename, qoi_desc *desc, int channels) {
+#ifdef QOI_POSIX
+	qoi_ra ra;
+	qoi_io io;
+	void *pixels;
+
+	if (filename == NULL || desc == NULL || !qoi_ra_open(&ra, filename)) {
+		return NULL;
+	}
+	io.read = qoi_ra_read;
+	io.write = NULL;
+	io.user = &ra;
+	pixels = qoi_decode_io(&io, desc, channels);
+	qoi_ra_close(&ra);
+
+	/* A failed read ends the stream just like the end of the file */
+	if (ra.error) {
+		if (pixels) {
+			QOI_FREE(pixels);
+		}
+		errno = ra.error;
+		return NULL;
+	}
+	return pixels;
+#else
+	return qoi_read64(filename, desc, channels);
+#endif
+}
+
 #endif /* QOI_NO_STDIO */
 #endif /* QOI_IMPLEMENTATION */
+
@@ -40,6 +40,8 @@ SOFTWARE.
 #include "stb_image_write.h"
 
 #define QOI_IMPLEMENTATION
+#define QOI_STATS
+#define QOI_THREADS
 #include "qoi.h"
 
 #include "spng.h"
@@ -474,6 +476,12 @@ int opt_nodecode = 0;
 int opt_noencode = 0;
 int opt_norecurse = 0;
 int opt_onlytotals = 0;
+int opt_mt = 0;
+int opt_stats = 0;
+
+// Thread counts for the qoi_encode_mt scaling curve
+#define MT_STEPS 5
+static const int mt_threads[MT_STEPS] = {1, 2, 4, 8, 16};
 
 typedef struct {
 	uint64_t size;
@@ -483,6 +491,7 @@ typedef struct {
 
 typedef struct {
 	int count;
+	int channels;
 	uint64_t disk_size;
 	uint64_t raw_size; //difference between this and using `px` is this takes original channel count into account
 	uint64_t px;
@@ -492,6 +501,12 @@ typedef struct {
 	benchmark_lib_result_t spng;
 	benchmark_lib_result_t stbi;
 	benchmark_lib_result_t qoi;
+	benchmark_lib_result_t qoi_table;
+	benchmark_lib_result_t qoi_native;
+	qoi_stats qoi_enc_stats;
+	qoi_stats qoi_dec_stats;
+	uint64_t qoi_mt_encode_time[MT_STEPS];
+	uint64_t qoi_mt_decode_time[MT_STEPS];
 } benchmark_result_t;
 
 void benchmark_print_lib(const char * name, benchmark_result_t res, benchmark_lib_result_t lib) {
@@ -499,17 +514,64 @@ void benchmark_print_lib(const char * name, benchmark_result_t res, benchmark_li
 	lib.decode_time /= res.count;
 	lib.size /= res.count;
 
-	printf("%-5s    %8.1f    %8.1f      %8.2f      %8.2f  %8llu  %7.1f%% %7.1f%% %8.2fx\n", name,
-		   lib.decode_time / 1000000.0,
-		   lib.encode_time / 1000000.0,
-		   lib.decode_time > 0 ? res.px / (lib.decode_time / 1000.0) : 0.0,
-		   lib.encode_time > 0 ? res.px / (lib.encode_time / 1000.0) : 0.0,
+	// Rows that only decode or only encode print "-" in the other columns
+	char decode_ms[16] = "       -", encode_ms[16] = "       -";
+	char decode_mpps[16] = "       -", encode_mpps[16] = "       -";
+	if (lib.decode_time > 0) {
+		snprintf(decode_ms, sizeof(decode_ms), "%8.1f", lib.decode_time / 1000000.0);
+		snprintf(decode_mpps, sizeof(decode_mpps), "%8.2f", res.px / (lib.decode_time / 1000.0));
+	}
+	if (lib.encode_time > 0) {
+		snprintf(encode_ms, sizeof(encode_ms), "%8.1f", lib.encode_time / 1000000.0);
+		snprintf(encode_mpps, sizeof(encode_mpps), "%8.2f", res.px / (lib.encode_time / 1000.0));
+	}
+
+	printf("%-5s    %s    %s      %s      %s  %8llu  %7.1f%% %7.1f%% %8.2fx\n", name,
+		   decode_ms,
+		   encode_ms,
+		   decode_mpps,
+		   encode_mpps,
 		   lib.size / 1024,
 		   lib.size / (res.px * 4.0) * 100,
 		   lib.size / (double) res.raw_size * 100,
 		   lib.size / (double) res.disk_size);
 }
 
+void benchmark_print_stats(benchmark_result_t res) {
+	static const char *run_buckets[QOI_STATS_RUN_BUCKETS] = {
+		"1", "2", "4", "8", "16", "32", "64", "128", "256", "512",
+		"1k", "2k", "4k", "8k", "16k", "32k+"
+	};
+	qoi_stats *st = &res.qoi_enc_stats;
+	uint64_t chunks = 0, bytes = 0, runs = 0;
+	for (int i = 0; i < QOI_STAT_OPS; i++) {
+		chunks += st->chunks[i];
+		bytes += st->bytes[i];
+	}
+	for (int i = 0; i < QOI_STATS_RUN_BUCKETS; i++) {
+		runs += st->runs[i];
+	}
+
+	printf("        index      diff      luma       run       rgb      rgba   idx hit   enc ms   dec ms\n");
+	printf("chunks");
+	for (int i = 0; i < QOI_STAT_OPS; i++) {
+		printf("  %7.1f%%", chunks ? st->chunks[i] * 100.0 / chunks : 0.0);
+	}
+	printf("  %7.1f%%  %7.1f  %7.1f\n",
+		st->index_hit_rate * 100.0,
+		st->time_ns / (double)res.count / 1000000.0,
+		res.qoi_dec_stats.time_ns / (double)res.count / 1000000.0);
+	printf("bytes ");
+	for (int i = 0; i < QOI_STAT_OPS; i++) {
+		printf("  %7.1f%%", bytes ? st->bytes[i] * 100.0 / bytes : 0.0);
+	}
+	printf("\nruns  ");
+	for (int i = 0; i < QOI_STATS_RUN_BUCKETS; i++) {
+		printf(" %s:%.1f%%", run_buckets[i], runs ? st->runs[i] * 100.0 / runs : 0.0);
+	}
+	printf("\n\n");
+}
+
 void benchmark_print_result(benchmark_result_t res) {
 	res.px /= res.count;
 	res.disk_size /= res.count;
@@ -524,7 +586,32 @@ void benchmark_print_result(benchmark_result_t res) {
 		benchmark_print_lib("stbi", res, res.stbi);
 	}
 	benchmark_print_lib("qoi", res, res.qoi);
+	if (!opt_nodecode) {
+		benchmark_print_lib("qoi-t", res, res.qoi_table);
+		benchmark_print_lib("qoi-n", res, res.qoi_native);
+	}
 	printf("\n");
+
+	if (opt_mt) {
+		printf("        threads     decode ms   decode mpps   speedup   encode ms   encode mpps   speedup\n");
+		for (int i = 0; i < MT_STEPS; i++) {
+			uint64_t dtime = res.qoi_mt_decode_time[i] / res.count;
+			uint64_t etime = res.qoi_mt_encode_time[i] / res.count;
+			printf("qoi-mt  %7d      %8.1f      %8.2f  %7.2fx    %8.1f      %8.2f  %7.2fx\n",
+				mt_threads[i],
+				dtime / 1000000.0,
+				dtime > 0 ? res.px / (dtime / 1000.0) : 0.0,
+				dtime > 0 ? res.qoi_mt_decode_time[0] / (double)res.qoi_mt_decode_time[i] : 0.0,
+				etime / 1000000.0,
+				etime > 0 ? res.px / (etime / 1000.0) : 0.0,
+				etime > 0 ? res.qoi_mt_encode_time[0] / (double)res.qoi_mt_encode_time[i] : 0.0);
+		}
+		printf("\n");
+	}
+
+	if (opt_stats) {
+		benchmark_print_stats(res);
+	}
 	fflush(stdout);
 }
 
@@ -581,11 +668,26 @@ benchmark_result_t benchmark_image(const char *path) {
 		if (memcmp(pixels, pixels_qoi, w * h * channels) != 0) {
 			ERROR_EXIT("QOI roundtrip pixel missmatch for %s", path);
 		}
+		memset(pixels_qoi, 0, w * h * channels);
+		qoi_decode_into(encoded_qoi, encoded_qoi_size, &dc, channels, pixels_qoi, 0, QOI_DISPATCH_TABLE);
+		if (memcmp(pixels, pixels_qoi, w * h * channels) != 0) {
+			ERROR_EXIT("QOI table dispatch roundtrip pixel missmatch for %s", path);
+		}
 		free(pixels_qoi);
 	}
 
 	benchmark_result_t res = {0};
 	res.count = 1;
+
+	if (opt_stats) {
+		size_t enc_size = 0;
+		qoi_desc dc;
+		void *enc_p = qoi_encode_ex(pixels, &qoiDesc, 0, channels == 4 ? QOI_LAYOUT_RGBA : QOI_LAYOUT_RGB, &enc_size, &res.qoi_enc_stats, NULL);
+		void *dec_p = qoi_decode_ex(enc_p, enc_size, &dc, 4, &res.qoi_dec_stats, NULL);
+		free(enc_p);
+		free(dec_p);
+	}
+	res.channels = channels;
 	res.disk_size = encoded_png_size;
 	res.raw_size = w * h * channels;
 	res.px = w * h;
@@ -620,6 +722,39 @@ benchmark_result_t benchmark_image(const char *path) {
 			void *dec_p = qoi_decode(encoded_qoi, encoded_qoi_size, &desc, 4);
 			free(dec_p);
 		});
+
+		// Same as above, but with the table driven op dispatch
+		BENCHMARK_FN(opt_nowarmup, opt_runs, res.qoi_table.decode_time, {
+			qoi_desc desc;
+			void *dec_p = malloc(w * h * 4);
+			qoi_decode_into(encoded_qoi, encoded_qoi_size, &desc, 4, dec_p, 0, QOI_DISPATCH_TABLE);
+			free(dec_p);
+		});
+
+		// Decode to the channel count of the image (3 for RGB images) instead
+		// of always expanding to RGBA
+		BENCHMARK_FN(opt_nowarmup, opt_runs, res.qoi_native.decode_time, {
+			qoi_desc desc;
+			void *dec_p = qoi_decode(encoded_qoi, encoded_qoi_size, &desc, channels);
+			free(dec_p);
+		});
+
+		// Multi-threaded decoding needs the seek index
+		if (opt_mt) {
+			size_t seekable_size;
+			void *seekable = qoi_encode_seekable(pixels, &qoiDesc, 0, &seekable_size);
+			for (int t = 0; t < MT_STEPS; t++) {
+				BENCHMARK_FN(opt_nowarmup, opt_runs, res.qoi_mt_decode_time[t], {
+					qoi_desc desc;
+					void *dec_p = qoi_decode_mt(seekable, seekable_size, &desc, channels, mt_threads[t]);
+					if (!opt_noverify && memcmp(pixels, dec_p, w * h * channels) != 0) {
+						ERROR_EXIT("QOI multi-threaded decoding missmatch for %s", path);
+					}
+					free(dec_p);
+				});
+			}
+			free(seekable);
+		}
 	}
 
 	// Encoding
@@ -660,8 +795,24 @@ benchmark_result_t benchmark_image(const char *path) {
 			res.qoi.size = enc_size;
 			free(enc_p);
 		});
+
+		if (opt_mt) {
+			for (int t = 0; t < MT_STEPS; t++) {
+				BENCHMARK_FN(opt_nowarmup, opt_runs, res.qoi_mt_encode_time[t], {
+					size_t enc_size;
+					void *enc_p = qoi_encode_mt(pixels, &qoiDesc, mt_threads[t], &enc_size);
+					if (!opt_noverify && (enc_size != (size_t)encoded_qoi_size || memcmp(enc_p, encoded_qoi, enc_size) != 0)) {
+						ERROR_EXIT("QOI multi-threaded encoding missmatch for %s", path);
+					}
+					free(enc_p);
+				});
+			}
+		}
 	}
 
+	res.qoi_table.size = res.qoi.size;
+	res.qoi_native.size = res.qoi.size;
+
 	free(pixels);
 	free(encoded_png);
 	free(encoded_qoi);
@@ -669,6 +820,56 @@ benchmark_result_t benchmark_image(const char *path) {
 	return res;
 }
 
+void benchmark_accumulate_stats(qoi_stats *total, const qoi_stats *st) {
+	uint64_t hits = total->chunks[QOI_STAT_INDEX] + st->chunks[QOI_STAT_INDEX];
+	uint64_t other = 0;
+	for (int i = 0; i < QOI_STAT_OPS; i++) {
+		total->chunks[i] += st->chunks[i];
+		total->bytes[i] += st->bytes[i];
+		if (i != QOI_STAT_RUN) {
+			other += total->chunks[i];
+		}
+	}
+	for (int i = 0; i < QOI_STATS_RUN_BUCKETS; i++) {
+		total->runs[i] += st->runs[i];
+	}
+	total->pixels += st->pixels;
+	total->index_hit_rate = other ? hits / (double)other : 0.0;
+	total->time_ns += st->time_ns;
+}
+
+void benchmark_accumulate(benchmark_result_t *total, benchmark_result_t res) {
+	total->count++;
+	total->disk_size += res.disk_size;
+	total->raw_size += res.raw_size;
+	total->px += res.px;
+	total->libpng.encode_time += res.libpng.encode_time;
+	total->libpng.decode_time += res.libpng.decode_time;
+	total->libpng.size += res.libpng.size;
+	total->spng.encode_time += res.spng.encode_time;
+	total->spng.decode_time += res.spng.decode_time;
+	total->spng.size += res.spng.size;
+	total->stbi.encode_time += res.stbi.encode_time;
+	total->stbi.decode_time += res.stbi.decode_time;
+	total->stbi.size += res.stbi.size;
+	total->qoi.encode_time += res.qoi.encode_time;
+	total->qoi.decode_time += res.qoi.decode_time;
+	total->qoi.size += res.qoi.size;
+	total->qoi_table.encode_time += res.qoi_table.encode_time;
+	total->qoi_table.decode_time += res.qoi_table.decode_time;
+	total->qoi_table.size += res.qoi_table.size;
+	total->qoi_native.encode_time += res.qoi_native.encode_time;
+	total->qoi_native.decode_time += res.qoi_native.decode_time;
+	total->qoi_native.size += res.qoi_native.size;
+	for (int i = 0; i < MT_STEPS; i++) {
+		total->qoi_mt_encode_time[i] += res.qoi_mt_encode_time[i];
+		total->qoi_mt_decode_time[i] += res.qoi_mt_decode_time[i];
+	}
+	benchmark_accumulate_stats(&total->qoi_enc_stats, &res.qoi_enc_stats);
+	benchmark_accumulate_stats(&total->qoi_dec_stats, &res.qoi_dec_stats);
+}
+
+// grand_total has 3 entries: all images, RGB images only, RGBA images only
 void benchmark_directory(const char *path, List<DirEnt> files, benchmark_result_t *grand_total) {
 	if (!opt_norecurse) {
 		for (DirEnt & file : files) {
@@ -708,39 +909,9 @@ void benchmark_directory(const char *path, List<DirEnt> files, benchmark_result_
 
 		free(file_path);
 
-		dir_total.count++;
-		dir_total.disk_size += res.disk_size;
-		dir_total.raw_size += res.raw_size;
-		dir_total.px += res.px;
-		dir_total.libpng.encode_time += res.libpng.encode_time;
-		dir_total.libpng.decode_time += res.libpng.decode_time;
-		dir_total.libpng.size += res.libpng.size;
-		dir_total.spng.encode_time += res.spng.encode_time;
-		dir_total.spng.decode_time += res.spng.decode_time;
-		dir_total.spng.size += res.spng.size;
-		dir_total.stbi.encode_time += res.stbi.encode_time;
-		dir_total.stbi.decode_time += res.stbi.decode_time;
-		dir_total.stbi.size += res.stbi.size;
-		dir_total.qoi.encode_time += res.qoi.encode_time;
-		dir_total.qoi.decode_time += res.qoi.decode_time;
-		dir_total.qoi.size += res.qoi.size;
-
-		grand_total->count++;
-		grand_total->disk_size += res.disk_size;
-		grand_total->raw_size += res.raw_size;
-		grand_total->px += res.px;
-		grand_total->libpng.encode_time += res.libpng.encode_time;
-		grand_total->libpng.decode_time += res.libpng.decode_time;
-		grand_total->libpng.size += res.libpng.size;
-		grand_total->spng.encode_time += res.spng.encode_time;
-		grand_total->spng.decode_time += res.spng.decode_time;
-		grand_total->spng.size += res.spng.size;
-		grand_total->stbi.encode_time += res.stbi.encode_time;
-		grand_total->stbi.decode_time += res.stbi.decode_time;
-		grand_total->stbi.size += res.stbi.size;
-		grand_total->qoi.encode_time += res.qoi.encode_time;
-		grand_total->qoi.decode_time += res.qoi.decode_time;
-		grand_total->qoi.size += res.qoi.size;
+		benchmark_accumulate(&dir_total, res);
+		benchmark_accumulate(&grand_total[0], res);
+		benchmark_accumulate(&grand_total[res.channels == 3 ? 1 : 2], res);
 	}
 
 	if (dir_total.count > 0) {
@@ -760,6 +931,8 @@ int main(int argc, char **argv) {
 		printf("    --nodecode ... don't run decoders\n");
 		printf("    --norecurse .. don't descend into directories\n");
 		printf("    --onlytotals . don't print individual image results\n");
+		printf("    --mt ......... also run qoi_encode_mt/qoi_decode_mt with 1..16 threads\n");
+		printf("    --stats ...... print qoi op statistics\n");
 		printf("Examples\n");
 		printf("    qoibench 10 images/textures/\n");
 		printf("    qoibench 1 images/textures/ --nopng --nowarmup\n");
@@ -774,6 +947,8 @@ int main(int argc, char **argv) {
 		else if (strcmp(argv[i], "--nodecode") == 0) { opt_nodecode = 1; }
 		else if (strcmp(argv[i], "--norecurse") == 0) { opt_norecurse = 1; }
 		else if (strcmp(argv[i], "--onlytotals") == 0) { opt_onlytotals = 1; }
+		else if (strcmp(argv[i], "--mt") == 0) { opt_mt = 1; }
+		else if (strcmp(argv[i], "--stats") == 0) { opt_stats = 1; }
 		else { ERROR_EXIT("Unknown option %s", argv[i]); }
 	}
 
@@ -782,13 +957,20 @@ int main(int argc, char **argv) {
 		ERROR_EXIT("Invalid number of runs %d", opt_runs);
 	}
 
-	benchmark_result_t grand_total = {0};
+	benchmark_result_t grand_total[3] = {};
 	List<DirEnt> files = fetch_dir_info_recursive(argv[2]);
-	benchmark_directory(argv[2], files, &grand_total);
-
-	if (grand_total.count > 0) {
+	benchmark_directory(argv[2], files, grand_total);
+
+	if (grand_total[0].count > 0) {
+		// Per channel count totals, since RGB and RGBA use different code paths
+		if (grand_total[1].count > 0 && grand_total[2].count > 0) {
+			printf("# Grand total for %s, RGB images (%d)\n", argv[2], grand_total[1].count);
+			benchmark_print_result(grand_total[1]);
+			printf("# Grand total for %s, RGBA images (%d)\n", argv[2], grand_total[2].count);
+			benchmark_print_result(grand_total[2]);
+		}
 		printf("# Grand total for %s\n", argv[2]);
-		benchmark_print_result(grand_total);
+		benchmark_print_result(grand_total[0]);
 	}
 	else {
 		printf("No images found in %s\n", argv[2]);
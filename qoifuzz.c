@@ -1,10 +1,15 @@
 /*
 
-clang fuzzing harness for qoi_decode
+clang fuzzing harness for the QOI decoders
 
 Compile and run with: 
 	clang -fsanitize=address,fuzzer -g -O0 qoifuzz.c && ./a.out
 
+The first byte of the input selects the decoder, the second byte the number of
+channels to decode to. The next QOIFUZZ_PARAMS bytes are parameters for the
+selected decoder (slice sizes, rows, a region, ...) and the rest of the input
+is the encoded image.
+
 Dominic Szablewski - https://phoboslab.org
 
 
@@ -31,19 +36,182 @@ SOFTWARE.
 */
 
 
-#define QOI_IMPLEMENTATION
-#include "qoi.h"
 #include <stddef.h>
 #include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Headers may claim images of many GB; fail these allocations instead of
+// running into the memory limit of the fuzzer
+#define QOIFUZZ_MALLOC_MAX (256 * 1024 * 1024)
+
+static void *qoifuzz_malloc(size_t size) {
+	return size > QOIFUZZ_MALLOC_MAX ? NULL : malloc(size);
+}
+
+#define QOI_MALLOC(sz) qoifuzz_malloc(sz)
+#define QOI_FREE(p) free(p)
+#define QOI_IMPLEMENTATION
+#include "qoi.h"
+
+// Some decoders don't allocate the whole image, or pad truncated data, so
+// their run time depends on the size in the header rather than on the input
+#define QOIFUZZ_PIXELS_MAX (1024 * 1024)
+#define QOIFUZZ_PARAMS 4
+
+enum {
+	QOIFUZZ_DECODE,
+	QOIFUZZ_DECODE_TABLE,
+	QOIFUZZ_DECODER_PUSH,
+	QOIFUZZ_DECODER_PULL,
+	QOIFUZZ_DECODE_SEEK,
+	QOIFUZZ_DECODE_REGION,
+	QOIFUZZ_DECODE_SCALED,
+	QOIFUZZ_DECODE_IO,
+	QOIFUZZ_DECODE_TILED,
+	QOIFUZZ_DECODE_SEQ,
+	QOIFUZZ_TARGETS
+};
+
+// The QOI, tiled and sequence headers all store the width and height (BE)
+// after the 4 magic bytes
+static int qoifuzz_too_large(const uint8_t *data, size_t size) {
+	unsigned long long w, h;
+	if (size < 12) {
+		return 0;
+	}
+	w = (unsigned)data[4] << 24 | data[5] << 16 | data[6] << 8 | data[7];
+	h = (unsigned)data[8] << 24 | data[9] << 16 | data[10] << 8 | data[11];
+	return w * h > QOIFUZZ_PIXELS_MAX;
+}
+
+static int qoifuzz_row(void *user, const void *row, unsigned int y) {
+	unsigned int stop = *(unsigned int *)user;
+	(void)row;
+	return y + 1 != stop;
+}
+
+// Hands out the input in reads of at most chunk bytes
+typedef struct {
+	const uint8_t *data;
+	size_t size;
+	size_t pos;
+	size_t chunk;
+} qoifuzz_reader;
+
+static size_t qoifuzz_read(void *user, void *buf, size_t len) {
+	qoifuzz_reader *r = (qoifuzz_reader *)user;
+	size_t n = r->size - r->pos;
+	if (n > len) {
+		n = len;
+	}
+	if (n > r->chunk) {
+		n = r->chunk;
+	}
+	memcpy(buf, r->data + r->pos, n);
+	r->pos += n;
+	return n;
+}
 
 int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
-	int w, h;
-	if (size < 4) {
+	if (size < 2 + QOIFUZZ_PARAMS) {
 		return 0;
 	}
 
+	int target = data[0] % QOIFUZZ_TARGETS;
+	int channels = data[1] % 5;
+	const uint8_t *p = data + 2;
+	const uint8_t *bytes = data + 2 + QOIFUZZ_PARAMS;
+	size_t len = size - 2 - QOIFUZZ_PARAMS;
 	qoi_desc desc;
-	void* decoded = qoi_decode((void*)(data + 4), (int)(size - 4), &desc, *((int *)data));
+	void *decoded = NULL;
+
+	if (qoifuzz_too_large(bytes, len)) {
+		return 0;
+	}
+
+	switch (target) {
+		case QOIFUZZ_DECODE:
+			decoded = qoi_decode(bytes, (int)len, &desc, channels);
+			break;
+
+		case QOIFUZZ_DECODE_TABLE:
+			if (qoi_probe(bytes, len, &desc)) {
+				decoded = malloc((size_t)desc.width * desc.height * 4);
+				qoi_decode_into(
+					bytes, len, &desc, channels, decoded, 0,
+					QOI_DISPATCH_TABLE | (p[0] & QOI_FLIP_Y)
+				);
+			}
+			break;
+
+		case QOIFUZZ_DECODER_PUSH: {
+			qoi_decoder dec;
+			unsigned int stop = p[1];
+			size_t slice = 1 + p[0];
+			if (qoi_decoder_init(&dec, channels, qoifuzz_row, &stop)) {
+				for (size_t i = 0; i < len; i += slice) {
+					if (!qoi_decoder_push(&dec, bytes + i, len - i < slice ? len - i : slice)) {
+						break;
+					}
+				}
+				qoi_decoder_finish(&dec);
+			}
+			break;
+		}
+
+		case QOIFUZZ_DECODER_PULL: {
+			qoifuzz_reader r = {bytes, len, 0, (size_t)1 + p[0]};
+			unsigned int nrows = 1 + p[1] % 16;
+			qoi_decoder dec;
+			if (qoi_decoder_open(&dec, channels, qoifuzz_read, &r)) {
+				decoded = malloc(dec.row_len * nrows);
+				while (decoded && qoi_decode_rows(&dec, decoded, nrows) > 0) {}
+				qoi_decoder_close(&dec);
+			}
+			break;
+		}
+
+		case QOIFUZZ_DECODE_SEEK:
+			decoded = qoi_decode_rows_at(bytes, len, &desc, channels, p[0], p[0] + p[1]);
+			free(decoded);
+			decoded = qoi_decode_mt(bytes, len, &desc, channels, 1 + p[2] % 4);
+			break;
+
+		case QOIFUZZ_DECODE_REGION:
+			decoded = qoi_decode_region(bytes, len, &desc, channels, p[0], p[1], p[2], p[3]);
+			break;
+
+		case QOIFUZZ_DECODE_SCALED:
+			decoded = qoi_decode_scaled(bytes, len, &desc, channels, p[0] % 9);
+			break;
+
+		case QOIFUZZ_DECODE_IO: {
+			qoifuzz_reader r = {bytes, len, 0, (size_t)1 + p[0]};
+			qoi_io io = {qoifuzz_read, NULL, &r};
+			decoded = qoi_decode_io(&io, &desc, channels);
+			break;
+		}
+
+		case QOIFUZZ_DECODE_TILED:
+			decoded = qoi_decode_tile(bytes, len, &desc, channels, p[0], p[1]);
+			free(decoded);
+			decoded = qoi_decode_tiled(bytes, len, &desc, channels, 1 + p[2] % 4);
+			break;
+
+		case QOIFUZZ_DECODE_SEQ: {
+			qoi_seq_decoder dec;
+			if (qoi_seq_decoder_open(&dec, bytes, len, channels)) {
+				// Frames can be decoded in any order; start at a random one
+				for (unsigned int i = 0; i < dec.frames && i < 8; i++) {
+					qoi_seq_decode_frame(&dec, (p[0] + i) % dec.frames);
+				}
+				qoi_seq_decoder_close(&dec);
+			}
+			break;
+		}
+	}
+
 	if (decoded != NULL) {
 		free(decoded);
 	}